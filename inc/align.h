@@ -0,0 +1,18 @@
+/**
+ * ===========================================================================
+ * align.h
+ * - --align: global (dx, dy) shift between ref and dst estimated on a few
+ *   sampled frames, applied as --ref-offset
+ * ===========================================================================
+ */
+#ifndef _ALIGN_H_
+#define _ALIGN_H_
+#include "quality_metric.h"
+
+#define ALIGN_SAMPLES     3    // frame pairs the shift is estimated on
+#define ALIGN_MAX_LEVELS  6    // luma pyramid levels, level l is 2^l times downsampled
+#define ALIGN_TOP_RANGE   4    // search radius in pixels at the coarsest level
+#define ALIGN_MIN_WIDTH   64   // the coarsest level keeps at least this many luma columns
+
+int  detect_alignment(QMContext* qmctx, int range, int offset[2]);
+#endif
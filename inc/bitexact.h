@@ -0,0 +1,13 @@
+/**
+ * ===========================================================================
+ * bitexact.h
+ * - --bitexact: compare the selected plane windows of every pair byte by
+ *   byte and stop at the first differing pixel, no metrics are computed
+ * ===========================================================================
+ */
+#ifndef _BITEXACT_H_
+#define _BITEXACT_H_
+#include "quality_metric.h"
+
+int run_bitexact(QMContext* qmctx);
+#endif
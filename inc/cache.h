@@ -0,0 +1,50 @@
+/**
+ * ===========================================================================
+ * cache.h
+ * - --cache: on-disk per-frame results keyed by a content fingerprint of
+ *   both inputs and every parameter the results depend on; cached frames
+ *   are not read again, only the missing ones are computed
+ * ===========================================================================
+ */
+#ifndef _CACHE_H_
+#define _CACHE_H_
+#include "quality_metric.h"
+#include "framesource.h"
+
+#define CACHE_MAGIC         0x31434d51  // "QMC1"
+#define CACHE_SAMPLE_PAGES  16          // pages hashed per input for its fingerprint, first and last included
+#define CACHE_PAGE_SIZE     4096
+
+typedef struct _cache_entry
+{
+    int64_t ssd[3];
+    double  ssim[3];
+    int     i_valid;
+}CacheEntry;
+
+typedef struct _result_cache
+{
+    int             i_enabled;
+    char            s_fname[FILE_NAME_LENGTH + 32];
+    uint64_t        i64_key;
+    CacheEntry*     entries;       // by pair number
+    int             i_size;        // entries allocated
+    int             i_end;         // pairs in the inputs, -1 until a run has read to the end
+    int             i_hits;
+    int             i_stored;      // computed this run
+    int             i_dirty;       // the file is rewritten on close
+    pthread_mutex_t mtx;
+}ResultCache;
+
+extern ResultCache g_result_cache;
+
+uint64_t xxh64(const void* data, size_t len, uint64_t seed);
+int  input_fingerprint(const char* fname, uint64_t* fp);
+int  open_result_cache(ResultCache* rc, QMContext* qmctx, int version);
+void close_result_cache(ResultCache* rc);
+int  result_cache_get(ResultCache* rc, int pair, int64_t ssd[], double ssim[]);
+int  result_cache_has(ResultCache* rc, int pair, int count);
+void result_cache_put(ResultCache* rc, int pair, int64_t ssd[], double ssim[]);
+void result_cache_set_end(ResultCache* rc, int pair);
+void show_cache_stats(FILE* out, ResultCache* rc);
+#endif
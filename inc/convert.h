@@ -0,0 +1,16 @@
+/**
+ * ===========================================================================
+ * convert.h
+ * - metrics between inputs of different chroma format and / or bit depth:
+ *   rows are brought to the compare format as they are loaded
+ * ===========================================================================
+ */
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+#include "quality_metric.h"
+
+#define CONV_ROWS 16  // rows converted per step, whole ssim block rows
+
+int  get_convert_temp_size(int width);
+void convert_frame_metric(QMContext* qmctx, Frame* ref, Frame* dst, void* temp, int64_t ssd[], double ssim[]);
+#endif
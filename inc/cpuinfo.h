@@ -0,0 +1,24 @@
+/**
+ * ===========================================================================
+ * cpuinfo.h
+ * - cpu lists, numa node topology and worker thread pinning
+ * ===========================================================================
+ */
+#ifndef _CPUINFO_H_
+#define _CPUINFO_H_
+
+#define MAX_CPUS  1024
+#define MAX_NODES 16
+
+typedef struct _cpu_set
+{
+    int   i_num;
+    short cpus[MAX_CPUS];
+}CpuSet;
+
+int  parse_cpu_list(const char* str, CpuSet* set);
+void intersect_cpu_set(CpuSet* set, const CpuSet* with);
+int  get_numa_nodes(CpuSet nodes[], int max_nodes);
+int  pin_current_thread(const CpuSet* set, int index);
+int  get_available_cpus(void);
+#endif
@@ -16,6 +16,7 @@ enum {
     CIDX_V = 2,
     CIDX_CHROMA = 1,
 };
+#define PLANES_ALL ((1 << CIDX_Y) | (1 << CIDX_U) | (1 << CIDX_V))  // --planes mask
 
 enum {
     YUV400 = 0,
@@ -0,0 +1,26 @@
+/**
+ * ===========================================================================
+ * follow.h
+ * - --follow: metric a dst file while the encoder is still writing it,
+ *   waiting for each frame to be complete before it is read
+ * ===========================================================================
+ */
+#ifndef _FOLLOW_H_
+#define _FOLLOW_H_
+#include "quality_metric.h"
+#include "framesource.h"
+
+#define FOLLOW_POLL_MS  500   // longest sleep between checks of the stop conditions
+
+typedef struct _follow_ctx
+{
+    int     i_notify_fd;     // inotify instance watching the dst file, -1: poll the size
+    int     i_idle_timeout;  // seconds without growth after which the file is taken as complete
+    int     i_pid;           // encoder process, the file is complete once it exited. 0: not watched
+    char*   s_sentinel;      // file whose appearance marks the dst as complete. empty: not watched
+}FollowCtx;
+
+int  init_follow(FollowCtx* fctx, QMContext* qmctx);
+void close_follow(FollowCtx* fctx);
+int  follow_wait(FollowCtx* fctx, FrameSource* src, int64_t size);
+#endif
@@ -0,0 +1,63 @@
+/**
+ * ===========================================================================
+ * frameindex.h
+ * - --index: binary per-frame metrics file written alongside the run, with
+ *   prefix sums and a min / max tree so "query" answers range averages,
+ *   aggregate-mse psnr and min / max without the yuvs
+ * ===========================================================================
+ */
+#ifndef _FRAMEINDEX_H_
+#define _FRAMEINDEX_H_
+#include "quality_metric.h"
+#ifdef _MSC_VER
+#include "w32thread.h"
+#else
+#include <pthread.h>
+#endif
+
+#define INDEX_MAGIC       0x31494d51  // "QMI1"
+#define INDEX_FANOUT      16          // frames / nodes per node of the min / max tree
+#define INDEX_MAX_LEVELS  16
+
+typedef struct _index_values
+{
+    int64_t ssd[3];
+    double  psnr[3];
+    double  ssim[3];
+}IndexValues;   // one frame, or the sum of frames 0 .. n - 1 in the prefix table
+
+typedef struct _index_node
+{
+    double  min[6];  // psnr y, u, v, ssim y, u, v
+    double  max[6];
+}IndexNode;
+
+typedef struct _index_header
+{
+    int     i_magic;
+    int     i_frames;
+    int     i_planes;
+    int     i_metric_method;
+    int     i_bit_depth;
+    int     i_levels;                               // tree levels, level 0 are the frames themselves
+    int64_t i64_area[3];                            // pixels per plane of the compared window
+    int64_t i64_level_pos[INDEX_MAX_LEVELS];        // file offset of the IndexNode's of every level > 0
+    int     i_level_size[INDEX_MAX_LEVELS];
+}IndexHeader;   // followed by i_frames IndexValues, i_frames + 1 prefix IndexValues, then the tree levels
+
+typedef struct _frame_index
+{
+    int             i_enabled;
+    IndexValues*    frames;      // by pair number, psnr filled in on write
+    char*           valid;
+    int             i_size;
+    pthread_mutex_t mtx;
+}FrameIndex;
+
+extern FrameIndex g_frame_index;
+
+void init_frame_index(FrameIndex* fi, QMContext* qmctx);
+void frame_index_put(FrameIndex* fi, int pair, int64_t ssd[], double ssim[]);
+int  write_frame_index(FrameIndex* fi, QMContext* qmctx);
+int  query_frame_index(int argc, char** argv);
+#endif
@@ -0,0 +1,24 @@
+/**
+ * ===========================================================================
+ * framemap.h
+ * - frame-rate mapping between ref and dst (--ref-fps / --dst-fps): which
+ *   ref and dst frame make up compared pair i
+ * ===========================================================================
+ */
+#ifndef _FRAMEMAP_H_
+#define _FRAMEMAP_H_
+#include "quality_metric.h"
+
+enum {
+    FPS_MAP_NONE    = 0,  // same rate, pair i is ref frame i and dst frame i
+    FPS_MAP_NEAREST = 1,  // one pair per dst frame, ref frame closest in time
+    FPS_MAP_DROP    = 2,  // one pair per frame of the slower input, frames of the faster one in between are dropped
+    FPS_MAP_REPEAT  = 3,  // one pair per frame of the faster input, frames of the slower one are repeated
+};
+
+int  parse_fps(const char* str, int fps[2]);
+int  parse_fps_map(const char* str);
+int64_t source_pair(QMContext* qmctx, int64_t pair);
+void map_frame_pair(QMContext* qmctx, int64_t pair, int64_t* ref_frm, int64_t* dst_frm);
+int  count_frame_pairs(QMContext* qmctx);
+#endif
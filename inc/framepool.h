@@ -0,0 +1,49 @@
+/**
+ * ===========================================================================
+ * framepool.h
+ * - recycling pool of 64-byte aligned frame buffers, optionally backed by
+ *   huge pages (MAP_HUGETLB, falling back to transparent huge pages)
+ * ===========================================================================
+ */
+#ifndef _FRAMEPOOL_H_
+#define _FRAMEPOOL_H_
+#include <stddef.h>
+#ifdef _MSC_VER
+#include "w32thread.h"
+#else
+#include <pthread.h>
+#endif
+
+#define FRAME_ALIGN 64          // plane and row start alignment, one cache line / one avx-512 vector
+#define HUGE_PAGE_SIZE (2 << 20)
+
+enum {
+    PB_MALLOC  = 0,
+    PB_HUGETLB = 1,             // explicit huge pages
+    PB_THP     = 2,             // anonymous mapping advised for transparent huge pages
+};
+
+typedef struct _pool_block
+{
+    unsigned char*      buf;
+    size_t              size;
+    int                 i_type;
+    int                 i_in_use;
+    struct _pool_block* next;
+}PoolBlock;
+
+typedef struct _frame_pool
+{
+    PoolBlock*      blocks;
+    int             i_hugepages;  // try huge pages for blocks >= HUGE_PAGE_SIZE
+    size_t          total_size;   // bytes held by the pool, used or free
+    pthread_mutex_t mtx;
+}FramePool;
+
+extern FramePool g_frame_pool;
+
+void  frame_pool_init(FramePool* pool, int hugepages);
+void* frame_pool_alloc(FramePool* pool, size_t size);
+void  frame_pool_release(FramePool* pool, void* buf);
+void  frame_pool_destroy(FramePool* pool);
+#endif
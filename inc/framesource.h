@@ -0,0 +1,73 @@
+/**
+ * ===========================================================================
+ * framesource.h
+ * - one shared, thread-safe positional reader per input yuv file
+ * - optional large-chunk mode for nfs / spinning disks: the file is read in
+ *   big sequential chunks into a small staging ring and frames are sliced
+ *   out of it
+ * - segmented inputs: "@list.txt" (one file per line) or a glob pattern is
+ *   read as the concatenation of its files, without copying them together
+ * ===========================================================================
+ */
+#ifndef _FRAMESOURCE_H_
+#define _FRAMESOURCE_H_
+#include "yuvframe.h"
+#include "defines.h"
+#include <stdio.h>
+#ifdef _MSC_VER
+#include "w32thread.h"
+#else
+#include <pthread.h>
+#endif
+
+#define IO_RING_SLOTS 2    // chunks staged per input: the one being sliced and the next
+#define SEG_OPEN_MAX  4    // files of a segmented input kept open at a time
+
+#ifdef linux
+typedef int   SegFile;
+#else
+typedef FILE* SegFile;
+#endif
+
+typedef struct _segment_list
+{
+    int             i_count;                    // 0: the input is one plain file
+    char**          names;
+    int64_t*        i64_start;                  // prefix table: offset of every segment in the virtual file, i_count + 1 entries
+    SegFile         file[SEG_OPEN_MAX];         // lazily opened segments, recycled least recently opened first
+    int             i_open_seg[SEG_OPEN_MAX];   // segment held by the slot, -1: free
+    int             i_users[SEG_OPEN_MAX];      // reads in progress on the slot, only an unused slot is recycled
+    int             i_next_slot;
+    pthread_mutex_t mtx;
+}SegmentList;
+
+typedef struct _frame_source
+{
+#ifdef linux
+    int             fd;
+#else
+    FILE*           file;
+#endif
+    pthread_mutex_t mtx;   // seek + read pair / staging ring must not interleave
+    int64_t         i64_file_size;
+
+    // --io-chunk
+    int             i_chunk;                        // 0: read frames straight from the file
+    uint8_t*        ring[IO_RING_SLOTS];
+    int64_t         i64_slot_pos[IO_RING_SLOTS];    // file offset of the staged chunk, -1 if empty
+    int             i_slot_len[IO_RING_SLOTS];
+    int             i_next_slot;                    // slot the next chunk replaces
+    int64_t         i64_bytes_read;                 // read from storage, for the MB/s report
+    double          f_read_time;                    // seconds spent in those reads
+
+    SegmentList     seg;
+}FrameSource;
+
+int     open_frame_source(FrameSource* src, const char* fname, int chunk);
+void    close_frame_source(FrameSource* src);
+void    show_source_stats(FILE* out, const char* name, FrameSource* src);
+int     source_read(FrameSource* src, int64_t offset, void* buf, int size);
+int     source_read_frame(FrameSource* src, Frame* f, int64_t frm_num, int planes, int win[3][4]);
+int     source_frame_num(FrameSource* src, Frame* f);
+int64_t source_refresh_size(FrameSource* src);
+#endif
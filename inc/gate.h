@@ -0,0 +1,56 @@
+/**
+ * ===========================================================================
+ * gate.h
+ * - --fail-below / --avg-target: pass / fail verdict for CI gates, the run
+ *   stops as soon as the verdict cannot change any more
+ * ===========================================================================
+ */
+#ifndef _GATE_H_
+#define _GATE_H_
+#include "quality_metric.h"
+#ifdef _MSC_VER
+#include "w32thread.h"
+#else
+#include <pthread.h>
+#endif
+
+#define GATE_EXIT_PASS  0
+#define GATE_EXIT_FAIL  2   // distinct from 1, the exit code of a normal run
+#define GATE_MAX_PSNR   99.9999  // ssd_to_psnr cap
+#define GATE_MIN_SSIM   -1.0
+
+enum
+{
+    GATE_OPEN    = 0,   // frame counted, verdict still open
+    GATE_DECIDED = 1,   // frame counted, the verdict is final: stop dispatching
+    GATE_PARTIAL = 2,   // the ssd of the frame stopped at its budget, its values are not printed
+};
+
+enum
+{
+    GATE_VERDICT_NONE = 0,
+    GATE_VERDICT_PASS = 1,
+    GATE_VERDICT_FAIL = 2,
+};
+
+typedef struct _quality_gate
+{
+    int             i_enabled;
+    int             i_pairs;          // pairs the run compares, 0 if not known up front (--follow)
+    int             i_frames;         // frames counted
+    int             i_verdict;        // GATE_VERDICT_*
+    double          sum_psnr[3];
+    double          sum_ssim[3];
+    char            s_reason[256];
+    pthread_mutex_t mtx;
+}QualityGate;
+
+extern QualityGate g_gate;
+
+int  parse_gate(const char* str, double* psnr, double* ssim);
+int  init_gate(QualityGate* gate, QMContext* qmctx);
+int  gate_frame(QualityGate* gate, QMContext* qmctx, int pair, int64_t ssd[], double ssim[]);
+int  gate_decided(QualityGate* gate);
+int  gate_cut_short(QualityGate* gate, int frames);
+int  gate_verdict(QualityGate* gate, QMContext* qmctx, FILE* out);
+#endif
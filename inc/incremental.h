@@ -0,0 +1,52 @@
+/**
+ * ===========================================================================
+ * incremental.h
+ * - --incremental: per thread context copy of the previous frame's compared
+ *   windows with the ssd and ssim block sums of every 4-row band, so bands
+ *   unchanged in both inputs are not computed again
+ * ===========================================================================
+ */
+#ifndef _INCREMENTAL_H_
+#define _INCREMENTAL_H_
+#include "quality_metric.h"
+#ifdef _MSC_VER
+#include "w32thread.h"
+#else
+#include <pthread.h>
+#endif
+
+typedef struct _inc_plane
+{
+    int      i_row_bytes;   // bytes of one window row
+    int      i_bands;       // bands of 4 rows, the last one may be shorter
+    uint8_t* prev_ref;      // window rows of the previous frame, i_row_bytes apart
+    uint8_t* prev_dst;
+    int64_t* band_ssd;      // by band
+    uint8_t* band_sums;     // ssim block sums by band, i_sums_bytes apart
+    int      i_sums_bytes;
+    float*   row_ssim;      // by ssim row, as ssim_plane adds them
+    char*    changed;       // by band, this frame
+}IncPlane;
+
+typedef struct _inc_state
+{
+    int      i_valid;       // planes hold the previous frame metric'd with this state
+    IncPlane planes[3];
+}IncState;
+
+typedef struct _inc_stats
+{
+    int             i_enabled;
+    int64_t         i64_bands;
+    int64_t         i64_reused;
+    pthread_mutex_t mtx;
+}IncStats;
+
+extern IncStats g_inc_stats;
+
+void init_inc_stats(IncStats* is);
+void show_inc_stats(FILE* out, IncStats* is);
+int  init_inc_state(IncState* st, QMContext* qmctx);
+void free_inc_state(IncState* st);
+void inc_frame_metric(IncState* st, QMContext* qmctx, Frame* ref, Frame* dst, int64_t ssd[], double ssim[]);
+#endif
@@ -21,6 +21,41 @@ static const struct option long_options[] =
     { "auto-skip",      required_argument, NULL, 0 },
     { "threads",        required_argument, NULL, 0 },
     { "metric-method",  required_argument, NULL, 1 },
+    { "stripes",        required_argument, NULL, 0 },
+    { "stream-rows",    required_argument, NULL, 0 },
+    { "max-memory",     required_argument, NULL, 0 },
+    { "hugepages",      required_argument, NULL, 0 },
+    { "affinity",       required_argument, NULL, 0 },
+    { "numa",           required_argument, NULL, 0 },
+    { "planes",         required_argument, NULL, 0 },
+    { "roi",            required_argument, NULL, 0 },
+    { "ref-width",      required_argument, NULL, 0 },
+    { "ref-height",     required_argument, NULL, 0 },
+    { "ref-offset",     required_argument, NULL, 0 },
+    { "align",          required_argument, NULL, 0 },
+    { "scale",          required_argument, NULL, 0 },
+    { "scale-to",       required_argument, NULL, 0 },
+    { "ref-bitdepth",   required_argument, NULL, 0 },
+    { "dst-bitdepth",   required_argument, NULL, 0 },
+    { "ref-chroma-format", required_argument, NULL, 0 },
+    { "dst-chroma-format", required_argument, NULL, 0 },
+    { "ref-fps",        required_argument, NULL, 0 },
+    { "dst-fps",        required_argument, NULL, 0 },
+    { "fps-map",        required_argument, NULL, 0 },
+    { "batch",          required_argument, NULL, 0 },
+    { "io-chunk",       required_argument, NULL, 0 },
+    { "follow",         required_argument, NULL, 0 },
+    { "follow-pid",     required_argument, NULL, 0 },
+    { "follow-sentinel", required_argument, NULL, 0 },
+    { "cache",          required_argument, NULL, 0 },
+    { "index",          required_argument, NULL, 0 },
+    { "ssim-ref",       required_argument, NULL, 0 },
+    { "incremental",    required_argument, NULL, 0 },
+    { "bitexact",       required_argument, NULL, 0 },
+    { "fail-below",     required_argument, NULL, 0 },
+    { "avg-target",     required_argument, NULL, 0 },
+    { "sample",         required_argument, NULL, 0 },
+    { "ci-stop",        required_argument, NULL, 0 },
     { 0, 0, 0, 0 },
 };
 
@@ -28,11 +63,12 @@ static void showHelp(void)
 {
     printf("Quality Metric Tool (Calculate psnr or ssim for yuvs) - Version %d.%d.%d.%d\n", VER_MAJOR, VER_MINOR, VER_RELEASE, VER_BUILD);
     printf("Usage: quality_metric.exe [--option opt_value]\n");
+    printf("       quality_metric.exe query <index file> [first-last ...]   range averages, aggregate psnr, min / max from an --index\n");
     printf("\nExecutable Options\n");
     printf("   -h/--help                   show help text and exit\n");
     printf("\nOptions:\n");
-    printf("   --ref                       reference yuv input file name\n");
-    printf("   --dst                       dst       yuv input file name\n");
+    printf("   --ref                       reference yuv input file name, @list of segment files (one per line) or a glob of them, read as one file\n");
+    printf("   --dst                       dst       yuv input file name, @list or glob as for --ref\n");
     printf("   --bitdepth                  bitdepth of yuv input file. 8 or 10. default 8\n");
     printf("   --width                     source picture width\n");
     printf("   --height                    source picture height\n");
@@ -42,8 +78,47 @@ static void showHelp(void)
     printf("   --dst-skip-num              skip how many frames of the dst yuv. default 0\n");
     printf("   --auto-skip                 auto decide skip how many frames of ref yuv and dst yuv, may be inaccurate. default 0\n");           
     printf("   --output                    output result file name\n");
-    printf("   --threads                   Thread number (multi-thread not supported). default 1\n");
-    printf("   --metric-method             Quality Metric method: 1 - psnr; 2 - ssim; 3 - psnr + ssim. default 1");
+    printf("   --threads                   Thread number, or auto: cpus of the affinity mask capped by the cgroup cpu quota. default 1\n");
+    printf("   --metric-method             Quality Metric method: 1 - psnr; 2 - ssim; 3 - psnr + ssim. default 1\n");
+    printf("   --stripes                   split each plane into N bands computed concurrently by --threads workers, one frame at a time. default 1\n");
+    printf("   --stream-rows               read and metric frames in stripes of N rows (multiple of 4), memory no longer scales with frame size. default 0 (whole frames)\n");
+    printf("   --max-memory                frame buffer budget, e.g. 4096 (MB), 512M, 1.5G, 65536B. picks in-flight frames, stripes and stream rows to fit. default 0 (unlimited)\n");
+    printf("   --hugepages                 1: back frame buffers with huge pages (MAP_HUGETLB, else transparent huge pages). default 0\n");
+    printf("   --affinity                  pin worker threads one per cpu of this list, e.g. 0-7,16-23. default unpinned\n");
+    printf("   --numa                      1: per numa node worker group pinned to the node, node-local frame buffers and reader shard. default 0\n");
+    printf("   --planes                    planes to read and compute: y, yuv, uv, ... others are skipped and shown as -. default yuv\n");
+    printf("   --roi                       x,y,w,h: metrics on this luma window only, rows outside it are not read. auto: detect letterbox bars. default whole frame\n");
+    printf("   --ref-width / --ref-height  ref geometry when it differs from --width / --height, e.g. 1920x1080 source vs 1920x1088 recon. default same\n");
+    printf("   --ref-offset                x,y: ref luma position of dst pixel 0,0; the common window of both frames is compared. default 0,0\n");
+    printf("   --align                     N: estimate the ref / dst shift within +-N luma pixels around --ref-offset on a few frames and use it as --ref-offset. default 0 (off)\n");
+    printf("   --scale                     bilinear, bicubic or lanczos: resample one side when --ref-width / --ref-height differ from --width / --height. default off\n");
+    printf("   --scale-to                  ref: dst is resampled to the ref resolution; dst: ref is resampled to the dst resolution. default ref\n");
+    printf("   --ref-bitdepth / --dst-bitdepth             per input bit depth. compared at the lower one. default --bitdepth\n");
+    printf("   --ref-chroma-format / --dst-chroma-format   per input chroma format. compared at the coarser one. default --chroma-format\n");
+    printf("   --ref-fps / --dst-fps       frame rates, e.g. 60 and 30000/1001, when they differ. default same\n");
+    printf("   --fps-map                   nearest: dst frames vs the closest ref frame; drop: frames of the slower input, the faster one decimated;\n");
+    printf("                               repeat: frames of the faster input, the slower one repeated. default nearest\n");
+    printf("   --batch                     frames per read and per job with --threads > 1, or auto (~2 MB per read, max 64). default 1\n");
+    printf("   --io-chunk                  read each input in chunks of this size, e.g. 64M, alternating between files; reports MB/s per input. default 0 (off)\n");
+    printf("   --follow                    N: dst is still being written, metric frames as they complete; done after N idle seconds,\n");
+    printf("                               on --follow-pid exit or when --follow-sentinel exists. default 0 (off)\n");
+    printf("   --follow-pid                pid of the encoder writing dst\n");
+    printf("   --follow-sentinel           file the encoder creates when dst is complete\n");
+    printf("   --cache                     directory of a result cache keyed by input fingerprints and parameters; cached frames are not read again\n");
+    printf("   --index                     write per-frame ssd / psnr / ssim with prefix sums to this binary file for the query command\n");
+    printf("   --ssim-ref                  sidecar of the ref ssim block sums: built on the first run, later runs against any dst\n");
+    printf("                               of the same ref compute only the dst and cross sums\n");
+    printf("   --incremental               1: reuse the ssd and ssim sums of 4-row bands unchanged in both inputs since the previous\n");
+    printf("                               frame, for static and screen content. best single-threaded or with --batch. default 0\n");
+    printf("   --bitexact                  1: no metrics, stop at the first pixel differing between the inputs and report it;\n");
+    printf("                               exit code 0 if all frames are identical, 1 otherwise. default 0\n");
+    printf("   --fail-below                psnr:N,ssim:N  gate: fail on the first frame under a threshold in a selected plane\n");
+    printf("   --avg-target                psnr:N,ssim:N  gate: fail if the average of a selected plane misses the target.\n");
+    printf("                               a gate stops once its verdict is decided; exit code 0 pass, 2 fail\n");
+    printf("   --sample                    every:K | random:N[:SEED] | list:FILE  compare a subset of the frames: every K-th,\n");
+    printf("                               one random frame of each of N equal runs, or the 1-based frame numbers in FILE\n");
+    printf("   --ci-stop                   stop once the 95%% interval of the mean psnr (ssim without psnr) of every selected\n");
+    printf("                               plane is within +-N; the frames are taken in random order, the interval is reported");
     printf("\n");
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+/**
+ * ===========================================================================
+ * planner.h
+ * - memory budgeted execution: pick frame / stripe / stream parallelism,
+ *   in-flight frame pairs and stripe height that fit --max-memory
+ * ===========================================================================
+ */
+#ifndef _PLANNER_H_
+#define _PLANNER_H_
+#include "quality_metric.h"
+
+enum {
+    PLAN_FRAME  = 0,  // whole frames, one pair per thread context
+    PLAN_STRIPE = 1,  // one pair in flight, planes split into bands over all threads
+    PLAN_STREAM = 2,  // row stripes streamed per thread context
+};
+
+typedef struct _mem_plan
+{
+    int     i_mode;
+    int     i_inflight;    // frame pairs (thread contexts) in flight
+    int     i_stripes;
+    int     i_stream_rows;
+    int     i_batch;       // frames per job and read in frame mode
+    int64_t i64_bytes;     // estimated pixel + scratch buffer bytes
+}MemPlan;
+
+int64_t parse_mem_size(const char* str);
+int64_t estimate_plan_memory(QMContext* qmctx, MemPlan* plan);
+int     plan_memory(QMContext* qmctx, MemPlan* plan);
+int     get_auto_batch_size(QMContext* qmctx);
+int     get_max_batch_size(QMContext* qmctx);
+void    show_memory_plan(QMContext* qmctx, MemPlan* plan);
+#endif
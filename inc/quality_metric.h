@@ -14,9 +14,30 @@ typedef struct _stat_result
     pthread_mutex_t mtx;
 }StatResult;
 
+typedef struct _ssim_stream
+{
+    void* sum0;        // rolling block-row sums, int[4] (8-bit) or int64_t[4] (16-bit)
+    void* sum1;
+    int   i_width;     // plane width in pixels
+    int   i_16bit;
+    int   i_max;
+    int   i_blk_rows;  // block rows consumed so far
+    float ssim;
+}SsimStream;
+
+typedef struct _ssim_ref_stats
+{
+    uint32_t* sq[3];   // per plane sum of squares and sum of the ref pixels of every 4x4 block
+    uint16_t* sum[3];  // of the ia_ref_win window, block row after block row. NULL: from the pixels
+}SsimRefStats;
+
 typedef struct _QualityMetric_Context
 {
 #define FILE_NAME_LENGTH 512
+#define MAX_BATCH        64
+#define MAX_BATCH_BYTES  (4 << 20)          // read per input of one --batch job, keeps frames * frame size in an int
+#define MAX_IO_CHUNK     (1 << 30)
+#define SSD_BUDGET_ROWS  16                 // rows summed between checks of i64_ssd_budget
     char  s_ref_fname[FILE_NAME_LENGTH];  // reference yuv file name
     char  s_dst_fname[FILE_NAME_LENGTH];  // dist yuv file name
     char  s_out_fname[FILE_NAME_LENGTH];  // output result file name
@@ -30,16 +51,73 @@ typedef struct _QualityMetric_Context
     int   i_dst_skip_num;
     int   i_auto_skip;                    // auto decide skipped frame numbers of ref and dst yuv. default 0
     int   i_metric_method;                // quality metric method(psnr & ssim): 1 - psnr, 2 - ssim, 3 - psnr + ssim
+    int   i_planes;                       // bit (1 << cidx) set: plane is read and metric'd. default PLANES_ALL
+    int   ia_roi[4];                      // --roi x, y, w, h in luma pixels. w = 0: whole frame
+    int   i_roi_auto;                     // --roi auto: ia_roi from letterbox detection
+    int   ia_win[3][4];                   // x, y, w, h per plane the metrics run on, derived from ia_roi
+    int   i_ref_width;                    // ref geometry when it differs from the dst (--width / --height), e.g. 1080 vs 1088
+    int   i_ref_height;
+    int   ia_ref_offset[2];               // luma position in ref of dst pixel (0, 0)
+    int   ia_ref_win[3][4];               // ia_win in ref coordinates
+    int   i_align;                        // --align: search range in luma pixels of the ref / dst shift estimated into ia_ref_offset, 0 = off
+    int   i_scale;                        // --scale resampling filter, SCALE_NONE: geometries are compared as they are
+    int   i_scale_target;                 // SCALE_TO_REF: dst is resampled to the ref geometry, SCALE_TO_DST: the reverse
+    int   i_ref_bit_depth;                // per input format, 0 / -1: --bitdepth / --chroma-format.
+    int   i_ref_chroma_format;            // i_bit_depth and i_chroma_format then become the compare format:
+    int   i_dst_bit_depth;                // the lower bit depth and the coarser chroma of the two
+    int   i_dst_chroma_format;
+    int   i_convert;                      // formats differ, rows are converted to the compare format on load
+    int   ia_ref_fps[2];                  // --ref-fps / --dst-fps as num / den, 0 / 1 if not given
+    int   ia_dst_fps[2];
+    int   i_fps_map;                      // FPS_MAP_*: how pair i maps to ref and dst frames when the rates differ
     int   i_threads;
+    int   i_stripes;                      // horizontal bands per plane computed concurrently. 1 = frame-level parallelism only
+    int   i_stream_rows;                  // > 0: read and metric frames in stripes of this many rows instead of whole frames
+    int   i_inflight;                     // frame pairs in flight (thread contexts) of the multi-thread path. 0 = threads + 4
+    int64_t i64_max_memory;               // buffer memory budget in bytes, 0 = unlimited
+    int   i_hugepages;                    // back large frame buffers with huge pages
+    char  s_affinity[FILE_NAME_LENGTH];   // cpu list workers are pinned to, e.g. "0-7,16-23". empty = unpinned
+    int   i_numa;                         // one worker group, thread contexts and reader shard per numa node
+    int   i_io_chunk;                     // bytes per staged storage read, 0: read frames directly
+    int   i_batch;                        // consecutive frames read and metric'd per job in the multi-thread path
+    int   i_follow;                       // --follow: dst is still being written, complete after this many idle seconds. 0 = off
+    int   i_follow_pid;                   // encoder process writing dst, complete once it exits. 0 = not watched
+    char  s_follow_sentinel[FILE_NAME_LENGTH];  // dst is complete once this file exists. empty = not watched
+    char  s_cache_dir[FILE_NAME_LENGTH];  // --cache: directory of the result cache. empty = off
+    char  s_index_fname[FILE_NAME_LENGTH];  // --index: binary per-frame metrics index written at the end. empty = off
+    char  s_ssim_ref_fname[FILE_NAME_LENGTH];  // --ssim-ref: sidecar of the ref ssim block sums, built if missing. empty = off
+    int   i_bitexact;                     // --bitexact: pairs are only compared byte for byte, the run stops at the first mismatch
+    double f_fail_psnr;                   // --fail-below: a frame under this psnr / ssim in a selected plane fails the gate. 0 = off
+    double f_fail_ssim;
+    double f_avg_psnr;                    // --avg-target: the average has to reach this psnr / ssim. 0 = off
+    double f_avg_ssim;
+    int64_t i64_ssd_budget[3];            // per plane ssd from which a frame is under f_fail_psnr, summing stops there. 0 = no budget
+    int   i_incremental;                  // --incremental: block rows unchanged in both inputs since the previous frame are not recomputed
+    int   i_sample;                       // --sample: SAMPLE_* mode, -1 if invalid
+    int   i_sample_arg;                   // every:K / random:N
+    unsigned int i_sample_seed;           // random:N:SEED
+    char  s_sample_list[FILE_NAME_LENGTH];  // list:FILE
+    int*  ia_sample;                      // pair of the full run of every pair of the run. NULL = no sampling
+    int   i_sample_num;
+    int   i_sample_pairs;                 // pairs of the full run the sample is drawn from
+    double f_ci_stop;                     // --ci-stop: half width of the 95% interval of the mean that ends the run. 0 = off
     int   i_exit;
     StatResult result_stat;
 }QualityMetricContext, QMContext;
 
+extern const char* plane_name[3];       // "Y", "U", "V", for messages
+
+int     get_ssim_temp_size(int width, int bit_depth);
+int     get_metric_temp_size(QMContext* qmctx);
 int64_t get_block_ssd_8bit(unsigned char* pix1, unsigned char* pix2, int width, int height);
 int64_t get_block_ssd_10bit(uint16_t* pix1, uint16_t* pix2, int width, int height);
-void    get_frame_ssd(Frame* ref, Frame* dst, int64_t ssd[]);
+int64_t get_block_ssd_8bit_stride(unsigned char* pix1, int stride1, unsigned char* pix2, int stride2, int width, int height);
+int64_t get_block_ssd_10bit_stride(uint16_t* pix1, int stride1, uint16_t* pix2, int stride2, int width, int height);
+int64_t get_plane_ssd_budget(uint8_t* pix1, int stride1, uint8_t* pix2, int stride2, int width, int height, int pixel_size, int64_t budget);
 int     jump_to_frame(FILE* in_f, int64_t frame_size, int64_t frame_number);
 double  ssd_to_psnr(double max_ssd, int64_t act_ssd);
+int     parse_planes(const char* str);
+int     sprint_plane_values(char* str, double val[], int planes);
 void    get_default_qmctx(QMContext* qmctx);
 float   ssim_plane(uint8_t *main, int main_stride,
                    uint8_t *ref, int ref_stride,
@@ -48,5 +126,35 @@ float ssim_plane_16bit(uint8_t *main, int main_stride,
                        uint8_t *ref, int ref_stride,
                        int width, int height, void *temp,
                        int max);
+void  ssim_plane_band(uint8_t *main, int main_stride,
+                      uint8_t *ref, int ref_stride,
+                      int width, int y_begin, int y_end,
+                      void *temp, float *row_ssim);
+void  ssim_plane_band_16bit(uint8_t *main, int main_stride,
+                            uint8_t *ref, int ref_stride,
+                            int width, int y_begin, int y_end,
+                            void *temp, float *row_ssim, int max);
+float ssim_rows_to_plane(const float *row_ssim, int width, int height);
+void  ssim_stream_init(SsimStream* ss, void* temp, int width, int pixel_size, int max);
+void  ssim_stream_push(SsimStream* ss, uint8_t *main, int main_stride,
+                       uint8_t *ref, int ref_stride, int blk_rows);
+float ssim_stream_end(SsimStream* ss);
+int   plane_identical(uint8_t *p_ref, int ref_stride, uint8_t *p_dst, int dst_stride, int row_bytes, int height);
+void  ssim_block_row(uint8_t *main, int main_stride, uint8_t *ref, int ref_stride,
+                     void *sums, int width, int pixel_size);
+float ssim_block_row_end(const void *sum0, const void *sum1, int width, int pixel_size, int max);
+float ssim_plane_refstats(uint8_t *main, int main_stride,
+                          uint8_t *ref, int ref_stride,
+                          int width, int height, void *temp, int max,
+                          const uint32_t *sq, const uint16_t *sum);
+float ssim_plane_refstats_16bit(uint8_t *main, int main_stride,
+                                uint8_t *ref, int ref_stride,
+                                int width, int height, void *temp, int max,
+                                const uint32_t *sq, const uint16_t *sum);
+void  ssim_ref_block_stats(uint8_t *ref, int stride, int width, int height, int pixel_size,
+                           uint32_t *sq, uint16_t *sum);
+void  get_frame_metric(QMContext* qmctx, Frame* ref, Frame* dst, void* temp, int64_t ssd[], double ssim[]);
+void  get_frame_metric_refstats(QMContext* qmctx, Frame* ref, Frame* dst, void* temp, const SsimRefStats* stats,
+                                int64_t ssd[], double ssim[]);
 
 #endif
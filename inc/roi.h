@@ -0,0 +1,19 @@
+/**
+ * ===========================================================================
+ * roi.h
+ * - --roi crop window: metrics on a rectangle of the frame, letterbox
+ *   detection for --roi auto
+ * ===========================================================================
+ */
+#ifndef _ROI_H_
+#define _ROI_H_
+#include "quality_metric.h"
+
+#define ROI_MIN_SIZE    16   // smallest window side, chroma keeps at least two 4x4 ssim blocks
+#define LB_SAMPLES      5    // frames sampled by letterbox detection
+#define LB_BLACK_LEVEL  24   // 8-bit luma at or below which a row / column counts as bar
+
+int  parse_roi(const char* str, int roi[4]);
+int  detect_letterbox(QMContext* qmctx, int roi[4]);
+int  init_plane_windows(QMContext* qmctx, Frame* ref_geom, Frame* geom);
+#endif
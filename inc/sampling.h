@@ -0,0 +1,56 @@
+/**
+ * ===========================================================================
+ * sampling.h
+ * - --sample: the run compares a subset of the pairs, every K-th, one random
+ *   pair per stratum or a frame list; pair i of the run is ia_sample[i]
+ * - --ci-stop: the run ends once the 95% confidence interval of the running
+ *   mean is narrower than the tolerance in every selected plane
+ * ===========================================================================
+ */
+#ifndef _SAMPLING_H_
+#define _SAMPLING_H_
+#include "quality_metric.h"
+#ifdef _MSC_VER
+#include "w32thread.h"
+#else
+#include <pthread.h>
+#endif
+
+#define SAMPLE_MIN_FRAMES  10     // frames before --ci-stop trusts the sample variance
+#define SAMPLE_Z           1.96   // two-sided 95%
+
+enum
+{
+    SAMPLE_NONE   = 0,
+    SAMPLE_EVERY  = 1,   // every:K, pairs 0, K, 2K, ...
+    SAMPLE_RANDOM = 2,   // random:N[:SEED], the pairs cut into N equal strata, one random pair of each
+    SAMPLE_LIST   = 3,   // list:FILE, 1-based frame numbers
+};
+
+enum
+{
+    SAMPLE_GO   = 0,
+    SAMPLE_STOP = 1,     // the interval is narrow enough: stop dispatching
+};
+
+typedef struct _sample_stats
+{
+    int             i_enabled;
+    int             i_pairs;          // pairs of the full run, the population of the mean
+    int             i_total;          // pairs in the sample
+    int             i_frames;         // frames counted
+    int             i_stopped;        // --ci-stop ended the run
+    double          mean[3];          // running mean and sum of squared deviations (welford) per plane
+    double          m2[3];
+    pthread_mutex_t mtx;
+}SampleStats;
+
+extern SampleStats g_sample_stats;
+
+int  parse_sample(const char* str, QMContext* qmctx);
+int  build_sample_table(QMContext* qmctx);
+void free_sample_table(QMContext* qmctx);
+void init_sample_stats(SampleStats* ss, QMContext* qmctx);
+int  sample_frame(SampleStats* ss, QMContext* qmctx, int64_t ssd[], double ssim[]);
+void show_sample_stats(FILE* out, SampleStats* ss, QMContext* qmctx);
+#endif
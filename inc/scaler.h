@@ -0,0 +1,51 @@
+/**
+ * ===========================================================================
+ * scaler.h
+ * - separable resampler (bilinear / bicubic / lanczos) bringing one frame of
+ *   a pair to the resolution of the other
+ * ===========================================================================
+ */
+#ifndef _SCALER_H_
+#define _SCALER_H_
+#include "yuvframe.h"
+#include "defines.h"
+
+enum {
+    SCALE_NONE     = 0,
+    SCALE_BILINEAR = 1,
+    SCALE_BICUBIC  = 2,
+    SCALE_LANCZOS  = 3,
+};
+
+enum {
+    SCALE_TO_REF = 0,  // dst is resampled to the ref geometry
+    SCALE_TO_DST = 1,
+};
+
+#define SCALE_COEF_BITS 14  // filter taps sum to 1 << SCALE_COEF_BITS
+#define SCALE_MID_BITS  4   // extra fraction bits kept between the horizontal and vertical pass
+
+typedef struct _scale_filter
+{
+    int      i_taps;
+    int*     pos;       // first source pixel of every output pixel, window kept inside the plane
+    int32_t* coef;      // i_taps coefficients per output pixel, edge taps folded in
+}ScaleFilter;
+
+typedef struct _scaler
+{
+    int         i_method;
+    Frame       src_geom;
+    Frame       dst_geom;
+    ScaleFilter hor[2];  // luma, chroma
+    ScaleFilter ver[2];
+}Scaler;
+
+extern Scaler g_scaler;
+
+int  parse_scale_method(const char* str);
+int  init_scaler(Scaler* sc, int method, Frame* src_geom, Frame* dst_geom);
+void free_scaler(Scaler* sc);
+int  get_scaler_temp_size(Scaler* sc);
+void scale_frame(Scaler* sc, Frame* src, Frame* dst, int planes, void* temp);
+#endif
@@ -0,0 +1,43 @@
+/**
+ * ===========================================================================
+ * ssimref.h
+ * - --ssim-ref: sidecar holding the sum and sum of squares of every 4x4 ssim
+ *   block of the ref, so runs of many dst against one ref accumulate only
+ *   the dst and cross terms
+ * ===========================================================================
+ */
+#ifndef _SSIMREF_H_
+#define _SSIMREF_H_
+#include "quality_metric.h"
+#include "framesource.h"
+
+#define SSIMREF_MAGIC          0x31525351  // "QSR1"
+#define SSIMREF_MAX_BIT_DEPTH  12          // 16 samples still fit the uint16_t sum and uint32_t sum of squares
+
+typedef struct _ssim_ref
+{
+    int             i_enabled;
+    int             i_build;          // the sidecar did not exist: this run computes the sums and writes it on close
+    char            s_fname[FILE_NAME_LENGTH];
+    uint64_t        i64_key;          // ref fingerprint and the window geometry the sums belong to
+    int             ia_blocks[3];     // 4x4 blocks of each plane window, 0 for planes not stored
+    int             ia_plane_pos[3];  // offset of the plane's sums in a frame record
+    int             i_frame_bytes;    // bytes of one frame record
+    int64_t         i64_frames;       // ref frames the sidecar has a record slot for
+    char*           valid;            // by ref frame: the record holds the sums
+    FrameSource     src;              // reading
+    FILE*           file;             // building, written to s_fname.tmp
+    int64_t         i64_loaded;
+    int64_t         i64_built;
+    pthread_mutex_t mtx;
+}SsimRef;
+
+extern SsimRef g_ssim_ref;
+
+int  open_ssim_ref(SsimRef* sr, QMContext* qmctx);
+void close_ssim_ref(SsimRef* sr);
+int  get_ssim_ref_temp_size(SsimRef* sr);
+void ssim_ref_frame_metric(SsimRef* sr, QMContext* qmctx, int64_t ref_frm, Frame* ref, Frame* dst, void* temp,
+                           int64_t ssd[], double ssim[]);
+void show_ssim_ref_stats(FILE* out, SsimRef* sr);
+#endif
@@ -0,0 +1,27 @@
+/**
+ * ===========================================================================
+ * stream.h
+ * - stripe streaming: read ref / dst in row stripes and accumulate ssd and
+ *   ssim incrementally, memory is O(stripe rows) instead of O(frame size)
+ * ===========================================================================
+ */
+#ifndef _STREAM_H_
+#define _STREAM_H_
+#include "quality_metric.h"
+#include "framesource.h"
+
+typedef struct _stream_ctx
+{
+    Frame    geom;      // dst plane geometry only, no pixel buffer
+    Frame    ref_geom;  // ref plane geometry, differs with --ref-width / --ref-height
+    int      i_rows;    // rows per stripe, multiple of 4 so stripes hold whole ssim block rows
+    uint8_t* ref_rows;
+    uint8_t* dst_rows;
+    void*    temp;      // rolling sum0 / sum1 of SsimStream
+}StreamCtx;
+
+int  init_stream_context(StreamCtx* stctx, QMContext* qmctx, int rows);
+void free_stream_context(StreamCtx* stctx);
+int  stream_frame_metric(StreamCtx* stctx, QMContext* qmctx, FrameSource* ref_src, int ref_frm, FrameSource* dst_src, int dst_frm,
+                         int64_t ssd[], double ssim[]);
+#endif
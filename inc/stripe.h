@@ -0,0 +1,42 @@
+/**
+ * ===========================================================================
+ * stripe.h
+ * - intra-frame parallelism: split every plane into horizontal bands and
+ *   compute ssd / ssim of all bands of Y, U and V concurrently
+ * ===========================================================================
+ */
+#ifndef _STRIPE_H_
+#define _STRIPE_H_
+#include "quality_metric.h"
+#include "threadpool.h"
+
+#define MAX_STRIPES 64
+
+typedef struct _stripe_job
+{
+    struct _stripe_ctx* sctx;
+    int      i_cidx;
+    int      i_row_begin;  // first pixel row of the band
+    int      i_row_end;
+    int      i_blk_begin;  // first ssim block row computed by the band
+    int      i_blk_end;
+    void*    temp;         // private sum0 / sum1 buffer of this band
+    int64_t  ssd;
+}StripeJob;
+
+typedef struct _stripe_ctx
+{
+    QMContext*    qmctx;
+    threadpool_t* p_pool;
+    Frame*        ref_frame;
+    Frame*        dst_frame;
+    int           i_stripes;
+    int           i_job_num;
+    StripeJob     jobs[3 * MAX_STRIPES];
+    float*        row_ssim[3];  // per block-row ssim sums, reduced in order after all bands finished
+}StripeCtx;
+
+int  init_stripe_context(StripeCtx* sctx, QMContext* qmctx, threadpool_t* p_pool);
+void free_stripe_context(StripeCtx* sctx);
+void stripe_frame_metric(StripeCtx* sctx, Frame* ref, Frame* dst, int64_t ssd[], double ssim[]);
+#endif
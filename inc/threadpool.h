@@ -15,6 +15,8 @@
 #include <pthread.h>
 #endif
 
+#include "cpuinfo.h"
+
 #define MAX_THREADS 256
 
 typedef struct _job_desc_
@@ -43,10 +45,16 @@ typedef struct _threadpool
     pthread_cond_t   tp_cond;
     volatile int     i_exit;
     int              i_threads;
+    int              i_pending;  // jobs handed to threadpool_run and not finished yet
+    const CpuSet*    p_cpus;     // cpus the workers are pinned to, NULL = unpinned
+    int              i_pin_core; // 1: worker n on p_cpus->cpus[n]; 0: every worker on the whole set
+    int              i_started;
 }threadpool_t;
 
 int   threadpool_init(threadpool_t **p_pool, int threads);
+int   threadpool_init_affinity(threadpool_t **p_pool, int threads, const CpuSet* cpus, int pin_core);
 void  threadpool_run(threadpool_t *pool, void *(*func)(void *), void *arg, int wait_sign);
+void  threadpool_sync(threadpool_t *pool);
 void *threadpool_wait(threadpool_t *pool, void *arg);
 void  threadpool_delete(threadpool_t *pool);
 
@@ -2,6 +2,7 @@
 #define _YUVFRAME_H_
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 typedef struct yuv_frame {
     int   width[3];
@@ -12,9 +13,11 @@ typedef struct yuv_frame {
     int   frame_size;  // frame size in bytes
     int   y_size;
     int   uv_size;
+    int   stride[3];   // bytes from one row to the next: width * pixel_size as in the file, padded by alloc_frame
     unsigned char* yuv[3];
 }frame, Frame;
 
+void init_frame_geometry(Frame* f, int width, int height, int bit_depth, int chroma_format);
 int  alloc_frame(Frame* f, int width, int height, int bit_depth, int chroma_format);
 void free_frame(Frame* f);
 int  read_frame(FILE* in_f, Frame* f);
@@ -0,0 +1,185 @@
+/**
+ * ===========================================================================
+ * align.c
+ * - coarse-to-fine SAD search of the shift between ref and dst luma: full
+ *   search of a small radius on a 2^L downsampled pyramid level, then +-1
+ *   refinement on every finer level. Costs a few luma planes of reads and
+ *   well under a frame worth of SAD work per sample, against the full pass
+ * ===========================================================================
+ */
+#include "align.h"
+#include "framemap.h"
+#include "framesource.h"
+#include <string.h>
+
+typedef struct _luma_pyramid
+{
+    uint8_t* pix[ALIGN_MAX_LEVELS];  // 8-bit luma, level 0 at full resolution
+    int      width[ALIGN_MAX_LEVELS];
+    int      height[ALIGN_MAX_LEVELS];
+}LumaPyramid;
+
+static void free_pyramid(LumaPyramid* p, int levels)
+{
+    for (int l = 0; l < levels; l++)
+        free(p->pix[l]);
+}
+
+/* luma of frm, reduced to 8 bits, and its 2x2 box averaged levels */
+static int load_pyramid(FrameSource* src, Frame* f, int64_t frm, LumaPyramid* p, int levels)
+{
+    int w = f->width[CIDX_Y], h = f->height[CIDX_Y], shift = f->bit_depth - 8;
+
+    memset(p, 0, sizeof(LumaPyramid));
+    if (source_read_frame(src, f, frm, 1 << CIDX_Y, NULL) < 0)
+        return -1;
+    for (int l = 0; l < levels; l++)
+    {
+        p->pix[l]    = (uint8_t *)malloc((size_t)w * h);
+        p->width[l]  = w;
+        p->height[l] = h;
+        if (p->pix[l] == NULL)
+        {
+            free_pyramid(p, l);
+            return -1;
+        }
+        w /= 2;
+        h /= 2;
+    }
+    for (int y = 0; y < p->height[0]; y++)
+    {
+        uint8_t* s = f->yuv[CIDX_Y] + (int64_t)y * f->stride[CIDX_Y];
+        uint8_t* d = p->pix[0] + (int64_t)y * p->width[0];
+        if (f->pixel_size == 1)
+            memcpy(d, s, p->width[0]);
+        else
+            for (int x = 0; x < p->width[0]; x++)
+                d[x] = (uint8_t)(((uint16_t *)s)[x] >> shift);
+    }
+    for (int l = 1; l < levels; l++)
+    {
+        uint8_t* s  = p->pix[l - 1];
+        int      ss = p->width[l - 1];
+        for (int y = 0; y < p->height[l]; y++)
+            for (int x = 0; x < p->width[l]; x++)
+            {
+                uint8_t* q = s + (int64_t)2 * y * ss + 2 * x;
+                p->pix[l][(int64_t)y * p->width[l] + x] = (uint8_t)((q[0] + q[1] + q[ss] + q[ss + 1] + 2) >> 2);
+            }
+    }
+    return 0;
+}
+
+/* mean absolute difference of dst pixel (x, y) against ref pixel (x + dx, y + dy) over the overlap at level l,
+ * -1 if the overlap is under half of the dst picture in either direction */
+static double shift_cost(LumaPyramid* ref, LumaPyramid* dst, int samples, int l, int dx, int dy)
+{
+    int     w  = dst->width[l], h = dst->height[l];
+    int     x0 = dx < 0 ? -dx : 0;
+    int     y0 = dy < 0 ? -dy : 0;
+    int     x1 = ref->width[l] - dx < w ? ref->width[l] - dx : w;
+    int     y1 = ref->height[l] - dy < h ? ref->height[l] - dy : h;
+    int64_t sad = 0;
+
+    if (2 * (x1 - x0) < w || 2 * (y1 - y0) < h)
+        return -1;
+    for (int s = 0; s < samples; s++)
+        for (int y = y0; y < y1; y++)
+        {
+            uint8_t* pd = dst[s].pix[l] + (int64_t)y * w;
+            uint8_t* pr = ref[s].pix[l] + (int64_t)(y + dy) * ref[s].width[l] + dx;
+            int      row = 0;
+            for (int x = x0; x < x1; x++)
+                row += abs(pd[x] - pr[x]);
+            sad += row;
+        }
+    return (double)sad / ((double)(x1 - x0) * (y1 - y0) * samples);
+}
+
+/* best shift within radius of (cx, cy) on level l, only shifts on the gx / gy grid */
+static void search_level(LumaPyramid* ref, LumaPyramid* dst, int samples, int l, int radius, int gx, int gy, int best[2])
+{
+    int    cx = best[0], cy = best[1];
+    double best_cost = -1;
+
+    for (int dy = cy - radius; dy <= cy + radius; dy++)
+        for (int dx = cx - radius; dx <= cx + radius; dx++)
+        {
+            double cost;
+            if (dx % gx || dy % gy)
+                continue;
+            cost = shift_cost(ref, dst, samples, l, dx, dy);
+            if (cost >= 0 && (best_cost < 0 || cost < best_cost))
+            {
+                best_cost = cost;
+                best[0]   = dx;
+                best[1]   = dy;
+            }
+        }
+}
+
+/* Shift of dst against ref within +-range luma pixels of offset, snapped to the chroma grid of the compare format.
+ * offset: in the current --ref-offset, out the estimate; left alone if nothing could be sampled. */
+int detect_alignment(QMContext* qmctx, int range, int offset[2])
+{
+    FrameSource ref_src, dst_src;
+    Frame       ref_f, dst_f;
+    LumaPyramid ref_p[ALIGN_SAMPLES], dst_p[ALIGN_SAMPLES];
+    int         width  = qmctx->ia_width[CIDX_Y] < qmctx->i_ref_width ? qmctx->ia_width[CIDX_Y] : qmctx->i_ref_width;
+    int         gx     = qmctx->i_chroma_format == YUV420 || qmctx->i_chroma_format == YUV422 ? 2 : 1;
+    int         gy     = qmctx->i_chroma_format == YUV420 ? 2 : 1;
+    int         levels = 1, samples = 0, avail, best[2];
+
+    while (levels < ALIGN_MAX_LEVELS && (range >> (levels - 1)) > ALIGN_TOP_RANGE && (width >> levels) >= ALIGN_MIN_WIDTH)
+        levels++;
+    if (open_frame_source(&ref_src, qmctx->s_ref_fname, 0) < 0)
+        return -1;
+    if (open_frame_source(&dst_src, qmctx->s_dst_fname, 0) < 0)
+    {
+        close_frame_source(&ref_src);
+        return -1;
+    }
+    alloc_frame(&ref_f, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    alloc_frame(&dst_f, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+    avail = source_frame_num(&dst_src, &dst_f) - qmctx->i_dst_skip_num;
+    avail = avail < qmctx->i_frame_num ? avail : qmctx->i_frame_num;
+
+    for (int s = 0; s < ALIGN_SAMPLES && s < avail; s++)
+    {
+        int64_t ref_frm, dst_frm;
+        map_frame_pair(qmctx, (int64_t)avail * s / ALIGN_SAMPLES, &ref_frm, &dst_frm);
+        if (load_pyramid(&ref_src, &ref_f, ref_frm, &ref_p[samples], levels) < 0)
+            break;
+        if (load_pyramid(&dst_src, &dst_f, dst_frm, &dst_p[samples], levels) < 0)
+        {
+            free_pyramid(&ref_p[samples], levels);
+            break;
+        }
+        samples++;
+    }
+    free_frame(&ref_f);
+    free_frame(&dst_f);
+    close_frame_source(&dst_src);
+    close_frame_source(&ref_src);
+    if (samples == 0)
+        return 0;
+
+    // full search on the coarsest level, +-1 on the finer ones, the grid only applies at full resolution
+    best[0] = offset[0] >> (levels - 1);
+    best[1] = offset[1] >> (levels - 1);
+    search_level(ref_p, dst_p, samples, levels - 1, (range + (1 << (levels - 1)) - 1) >> (levels - 1), levels > 1 ? 1 : gx, levels > 1 ? 1 : gy, best);
+    for (int l = levels - 2; l >= 0; l--)
+    {
+        best[0] *= 2;
+        best[1] *= 2;
+        search_level(ref_p, dst_p, samples, l, l > 0 ? 1 : (gx > gy ? gx : gy), l > 0 ? 1 : gx, l > 0 ? 1 : gy, best);
+    }
+    for (int s = 0; s < samples; s++)
+    {
+        free_pyramid(&ref_p[s], levels);
+        free_pyramid(&dst_p[s], levels);
+    }
+    offset[0] = best[0];
+    offset[1] = best[1];
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * ===========================================================================
+ * bitexact.c
+ * - conformance check: pairs are read in order with the windows, planes and
+ *   frame mapping of a normal run and compared with memcmp per row; the first
+ *   differing row is scanned for the pixel
+ * - exit status as cmp: 0 all pairs identical, 1 at the first mismatch or
+ *   when one input ends before the other
+ * ===========================================================================
+ */
+#include "bitexact.h"
+#include "framesource.h"
+#include "framemap.h"
+#include <string.h>
+
+/* first pixel of the row that differs, the row is known to differ */
+static int first_diff_pixel(uint8_t* ref, uint8_t* dst, int width, int pixel_size)
+{
+    for (int x = 0; x < width; x++)
+        if (memcmp(ref + x * pixel_size, dst + x * pixel_size, pixel_size))
+            return x;
+    return 0;
+}
+
+static int pixel_value(uint8_t* p, int x, int pixel_size)
+{
+    return pixel_size == 1 ? p[x] : ((uint16_t *)p)[x];
+}
+
+/* 1 and the report printed if the windows of the pair differ */
+static int compare_pair(QMContext* qmctx, int pair, Frame* ref, Frame* dst)
+{
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int*  win        = qmctx->ia_win[cidx];
+        int*  ref_win    = qmctx->ia_ref_win[cidx];
+        int   ref_stride = ref->stride[cidx];
+        int   dst_stride = dst->stride[cidx];
+        uint8_t* p_ref   = ref->yuv[cidx] + (int64_t)ref_win[1] * ref_stride + ref_win[0] * ref->pixel_size;
+        uint8_t* p_dst   = dst->yuv[cidx] + (int64_t)win[1] * dst_stride + win[0] * dst->pixel_size;
+
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        for (int y = 0; y < win[3]; y++, p_ref += ref_stride, p_dst += dst_stride)
+        {
+            if (!memcmp(p_ref, p_dst, win[2] * ref->pixel_size))
+                continue;
+            int x = first_diff_pixel(p_ref, p_dst, win[2], ref->pixel_size);
+            fprintf(qmctx->out_file, "bitexact: frame %d plane %s differs first at x,y %d,%d: ref %d dst %d\n", (int)source_pair(qmctx, pair) + 1,
+                    plane_name[cidx], win[0] + x, win[1] + y, pixel_value(p_ref, x, ref->pixel_size), pixel_value(p_dst, x, dst->pixel_size));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int run_bitexact(QMContext* qmctx)
+{
+    FrameSource ref_src, dst_src;
+    Frame       ref_frame, dst_frame;
+    int64_t     ref_frm, dst_frm;
+    int         pair, ret = 0;
+
+    if (open_frame_source(&ref_src, qmctx->s_ref_fname, qmctx->i_io_chunk) < 0)
+    {
+        fprintf(stderr, "Open ref yuv file %s error!\n", qmctx->s_ref_fname);
+        return -1;
+    }
+    if (open_frame_source(&dst_src, qmctx->s_dst_fname, qmctx->i_io_chunk) < 0)
+    {
+        fprintf(stderr, "Open dst yuv file %s error!\n", qmctx->s_dst_fname);
+        close_frame_source(&ref_src);
+        return -1;
+    }
+    alloc_frame(&ref_frame, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    alloc_frame(&dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+
+    for (pair = 0; pair < qmctx->i_frame_num; pair++)
+    {
+        map_frame_pair(qmctx, pair, &ref_frm, &dst_frm);
+        int ref_ok = source_read_frame(&ref_src, &ref_frame, ref_frm, qmctx->i_planes, qmctx->ia_ref_win) >= 0;
+        int dst_ok = source_read_frame(&dst_src, &dst_frame, dst_frm, qmctx->i_planes, qmctx->ia_win) >= 0;
+        if (!ref_ok && !dst_ok)
+            break;
+        if (!ref_ok || !dst_ok)  // one input is longer
+        {
+            fprintf(qmctx->out_file, "bitexact: frame %d is missing in %s\n", (int)source_pair(qmctx, pair) + 1, ref_ok ? "dst" : "ref");
+            ret = 1;
+            break;
+        }
+        if (compare_pair(qmctx, pair, &ref_frame, &dst_frame))
+        {
+            ret = 1;
+            break;
+        }
+    }
+    if (ret == 0)
+        fprintf(qmctx->out_file, "bitexact: %d frames identical\n", pair);
+
+    free_frame(&ref_frame);
+    free_frame(&dst_frame);
+    show_source_stats(qmctx->out_file, "ref", &ref_src);
+    show_source_stats(qmctx->out_file, "dst", &dst_src);
+    close_frame_source(&dst_src);
+    close_frame_source(&ref_src);
+    return ret;
+}
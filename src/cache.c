@@ -0,0 +1,311 @@
+/**
+ * ===========================================================================
+ * cache.c
+ * - result cache: one file per key in the --cache directory holding the ssd
+ *   and ssim of every pair computed so far and, once known, the number of
+ *   pairs in the inputs
+ * - key = xxh64 of both input fingerprints (size + xxh64 of CACHE_SAMPLE_PAGES
+ *   sampled pages) and of the parameter string; a change outside the sampled
+ *   pages that keeps the size is not noticed
+ * ===========================================================================
+ */
+#include "cache.h"
+#include <string.h>
+#ifdef linux
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#endif
+
+ResultCache g_result_cache;
+
+typedef struct _cache_header
+{
+    int      i_magic;
+    int      i_end;
+    int      i_count;   // CacheRecord's that follow
+    int      i_reserved;
+    uint64_t i64_key;
+}CacheHeader;
+
+typedef struct _cache_record
+{
+    int     i_pair;
+    int     i_reserved;
+    int64_t ssd[3];
+    double  ssim[3];
+}CacheRecord;
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+#define XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t xxh_read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static uint32_t xxh_read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc  = XXH_ROTL(acc, 31);
+    return acc * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+/* XXH64, little-endian hosts */
+uint64_t xxh64(const void* data, size_t len, uint64_t seed)
+{
+    const uint8_t* p   = (const uint8_t *)data;
+    const uint8_t* end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + XXH_P1 + XXH_P2, v2 = seed + XXH_P2, v3 = seed, v4 = seed - XXH_P1;
+        do
+        {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = XXH_ROTL(v1, 1) + XXH_ROTL(v2, 7) + XXH_ROTL(v3, 12) + XXH_ROTL(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else
+        h = seed + XXH_P5;
+    h += (uint64_t)len;
+    for (; p + 8 <= end; p += 8)
+        h = XXH_ROTL(h ^ xxh_round(0, xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (p + 4 <= end)
+    {
+        h  = XXH_ROTL(h ^ (xxh_read32(p) * XXH_P1), 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = XXH_ROTL(h ^ (*p * XXH_P5), 11) * XXH_P1;
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* size + hash of CACHE_SAMPLE_PAGES pages spread evenly over the input, first and last page included */
+int input_fingerprint(const char* fname, uint64_t* fp)
+{
+    FrameSource src;
+    uint8_t     page[CACHE_PAGE_SIZE];
+    int64_t     pages;
+
+    if (open_frame_source(&src, fname, 0) < 0)
+        return -1;
+    pages = (src.i64_file_size + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+    *fp   = xxh64(&src.i64_file_size, sizeof(int64_t), 0);
+    for (int i = 0; i < CACHE_SAMPLE_PAGES && pages > 0; i++)
+    {
+        int64_t pos = (pages - 1) * i / (CACHE_SAMPLE_PAGES - 1) * CACHE_PAGE_SIZE;
+        int     len = (int)(src.i64_file_size - pos < CACHE_PAGE_SIZE ? src.i64_file_size - pos : CACHE_PAGE_SIZE);
+        if (source_read(&src, pos, page, len) < 0)
+        {
+            close_frame_source(&src);
+            return -1;
+        }
+        *fp = xxh64(page, len, *fp);
+    }
+    close_frame_source(&src);
+    return 0;
+}
+
+static int grow_entries(ResultCache* rc, int pair)
+{
+    int         size;
+    CacheEntry* e;
+    if (pair < rc->i_size)
+        return 0;
+    size = pair + 1 > 2 * rc->i_size ? pair + 1 : 2 * rc->i_size;
+    e    = (CacheEntry *)realloc(rc->entries, size * sizeof(CacheEntry));
+    if (e == NULL)
+        return -1;
+    memset(e + rc->i_size, 0, (size - rc->i_size) * sizeof(CacheEntry));
+    rc->entries = e;
+    rc->i_size  = size;
+    return 0;
+}
+
+/* everything the per-frame results depend on, after the options are resolved */
+static void sprint_cache_params(char* str, int len, QMContext* qmctx, int version)
+{
+    int n = snprintf(str, len, "v%08x %dx%d %dx%d %d,%d bd%d/%d cf%d/%d skip%d/%d m%d p%d s%d/%d fps%d/%d:%d/%d:%d",
+                     version, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_ref_width, qmctx->i_ref_height,
+                     qmctx->ia_ref_offset[0], qmctx->ia_ref_offset[1], qmctx->i_ref_bit_depth, qmctx->i_dst_bit_depth,
+                     qmctx->i_ref_chroma_format, qmctx->i_dst_chroma_format, qmctx->i_ref_skip_num, qmctx->i_dst_skip_num,
+                     qmctx->i_metric_method, qmctx->i_planes, qmctx->i_scale, qmctx->i_scale_target,
+                     qmctx->ia_ref_fps[0], qmctx->ia_ref_fps[1], qmctx->ia_dst_fps[0], qmctx->ia_dst_fps[1], qmctx->i_fps_map);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V && n < len; cidx++)
+        n += snprintf(str + n, len - n, " %d,%d,%d,%d", qmctx->ia_win[cidx][0], qmctx->ia_win[cidx][1], qmctx->ia_win[cidx][2], qmctx->ia_win[cidx][3]);
+}
+
+/* key the inputs and parameters, load the results cached for that key. -1 if an input cannot be fingerprinted */
+int open_result_cache(ResultCache* rc, QMContext* qmctx, int version)
+{
+    char        params[512];
+    uint64_t    ref_fp, dst_fp;
+    CacheHeader hdr;
+    CacheRecord rec;
+    FILE*       f;
+
+    memset(rc, 0, sizeof(ResultCache));
+    rc->i_end = -1;
+    if (input_fingerprint(qmctx->s_ref_fname, &ref_fp) < 0 || input_fingerprint(qmctx->s_dst_fname, &dst_fp) < 0)
+        return -1;
+    sprint_cache_params(params, sizeof(params), qmctx, version);
+    rc->i64_key = xxh64(params, strlen(params), xxh64(&dst_fp, sizeof(dst_fp), ref_fp));
+#ifdef linux
+    mkdir(qmctx->s_cache_dir, 0755);
+#else
+    _mkdir(qmctx->s_cache_dir);
+#endif
+    snprintf(rc->s_fname, sizeof(rc->s_fname), "%s/%016llx.qmc", qmctx->s_cache_dir, (unsigned long long)rc->i64_key);
+    pthread_mutex_init(&rc->mtx, NULL);
+    rc->i_enabled = 1;
+
+    f = fopen(rc->s_fname, "rb");
+    if (f == NULL)
+        return 0;
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.i_magic == CACHE_MAGIC && hdr.i64_key == rc->i64_key)
+    {
+        rc->i_end = hdr.i_end;
+        for (int i = 0; i < hdr.i_count && fread(&rec, sizeof(rec), 1, f) == 1; i++)
+        {
+            if (rec.i_pair < 0 || grow_entries(rc, rec.i_pair) < 0)
+                break;
+            memcpy(rc->entries[rec.i_pair].ssd, rec.ssd, sizeof(rec.ssd));
+            memcpy(rc->entries[rec.i_pair].ssim, rec.ssim, sizeof(rec.ssim));
+            rc->entries[rec.i_pair].i_valid = 1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* write the cache back if this run added to it: to a temp file renamed over the old one, so readers never see half a file */
+void close_result_cache(ResultCache* rc)
+{
+    char        tmp[FILE_NAME_LENGTH + 48];
+    CacheHeader hdr;
+    CacheRecord rec;
+    FILE*       f;
+
+    if (!rc->i_enabled)
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", rc->s_fname);
+    if (rc->i_dirty && (f = fopen(tmp, "wb")) != NULL)
+    {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.i_magic = CACHE_MAGIC;
+        hdr.i_end   = rc->i_end;
+        hdr.i64_key = rc->i64_key;
+        for (int i = 0; i < rc->i_size; i++)
+            hdr.i_count += rc->entries[i].i_valid;
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        memset(&rec, 0, sizeof(rec));
+        for (int i = 0; i < rc->i_size; i++)
+        {
+            if (!rc->entries[i].i_valid)
+                continue;
+            rec.i_pair = i;
+            memcpy(rec.ssd, rc->entries[i].ssd, sizeof(rec.ssd));
+            memcpy(rec.ssim, rc->entries[i].ssim, sizeof(rec.ssim));
+            fwrite(&rec, sizeof(rec), 1, f);
+        }
+        if (fclose(f) == 0)
+        {
+            remove(rc->s_fname);  // rename does not replace on windows
+            rename(tmp, rc->s_fname);
+        }
+    }
+    free(rc->entries);
+    pthread_mutex_destroy(&rc->mtx);
+    rc->i_enabled = 0;
+}
+
+/* 1 with the cached results of pair in ssd / ssim, 0 if it has to be computed */
+int result_cache_get(ResultCache* rc, int pair, int64_t ssd[], double ssim[])
+{
+    int hit = 0;
+    if (!rc->i_enabled)
+        return 0;
+    pthread_mutex_lock(&rc->mtx);
+    if (pair < rc->i_size && rc->entries[pair].i_valid)
+    {
+        memcpy(ssd, rc->entries[pair].ssd, 3 * sizeof(int64_t));
+        memcpy(ssim, rc->entries[pair].ssim, 3 * sizeof(double));
+        rc->i_hits++;
+        hit = 1;
+    }
+    pthread_mutex_unlock(&rc->mtx);
+    return hit;
+}
+
+/* 1 if pairs pair .. pair + count - 1 are all cached */
+int result_cache_has(ResultCache* rc, int pair, int count)
+{
+    int has = rc->i_enabled;
+    if (!has)
+        return 0;
+    pthread_mutex_lock(&rc->mtx);
+    for (int i = pair; i < pair + count && has; i++)
+        has = i < rc->i_size && rc->entries[i].i_valid;
+    pthread_mutex_unlock(&rc->mtx);
+    return has;
+}
+
+void result_cache_put(ResultCache* rc, int pair, int64_t ssd[], double ssim[])
+{
+    if (!rc->i_enabled)
+        return;
+    pthread_mutex_lock(&rc->mtx);
+    if (grow_entries(rc, pair) == 0)
+    {
+        memcpy(rc->entries[pair].ssd, ssd, 3 * sizeof(int64_t));
+        memcpy(rc->entries[pair].ssim, ssim, 3 * sizeof(double));
+        rc->entries[pair].i_valid = 1;
+        rc->i_stored++;
+        rc->i_dirty = 1;
+    }
+    pthread_mutex_unlock(&rc->mtx);
+}
+
+/* a read of pair hit the end of an input: the inputs hold pairs 0 .. pair - 1 */
+void result_cache_set_end(ResultCache* rc, int pair)
+{
+    if (!rc->i_enabled)
+        return;
+    pthread_mutex_lock(&rc->mtx);
+    if (rc->i_end < 0 || pair < rc->i_end)
+    {
+        rc->i_end   = pair;
+        rc->i_dirty = 1;
+    }
+    pthread_mutex_unlock(&rc->mtx);
+}
+
+void show_cache_stats(FILE* out, ResultCache* rc)
+{
+    if (!rc->i_enabled)
+        return;
+    fprintf(out, "cache: %d frames from %s, %d computed\n", rc->i_hits, rc->s_fname, rc->i_stored);
+}
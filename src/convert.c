@@ -0,0 +1,105 @@
+/**
+ * ===========================================================================
+ * convert.c
+ * - cross chroma-format / bit-depth metrics. Each side is loaded CONV_ROWS
+ *   rows at a time and converted on the way in: chroma is box-averaged down
+ *   to the compare format (the coarser one) and samples are rounded down to
+ *   the compare bit depth (the lower one). The converted rows go straight
+ *   into the ssd kernel and the incremental ssim, no converted frame exists
+ * ===========================================================================
+ */
+#include "convert.h"
+#include <string.h>
+
+/* bytes of the two converted row blocks appended to the ssim scratch buffer */
+int get_convert_temp_size(int width)
+{
+    return 2 * CONV_ROWS * width * sizeof(uint16_t);
+}
+
+static int cf_sub_x(int chroma_format) { return chroma_format == YUV444 ? 1 : 2; }
+static int cf_sub_y(int chroma_format) { return chroma_format == YUV420 ? 2 : 1; }
+
+/* rows y .. y + rows - 1 of window win (compare coordinates) of plane cidx of f, converted into out.
+ * fx * fy source samples form one output sample; log2(fx * fy) + shift bits are rounded off */
+static void convert_rows(Frame* f, int cidx, int* win, int fx, int fy, int shift, int y, int rows,
+                         uint8_t* out, int out_pixel_size)
+{
+    int stride = f->stride[cidx] / f->pixel_size;
+    int bits   = shift + (fx == 2) + (fy == 2);
+    int round  = bits ? 1 << (bits - 1) : 0;
+
+    for (int r = 0; r < rows; r++)
+    {
+        int64_t  sy  = (int64_t)(win[1] + y + r) * fy;
+        uint8_t* o8  = out + (int64_t)r * win[2] * out_pixel_size;
+        uint16_t* o16 = (uint16_t *)o8;
+        for (int x = 0; x < win[2]; x++)
+        {
+            int64_t sx  = (int64_t)(win[0] + x) * fx;
+            int     sum = 0;
+            for (int j = 0; j < fy; j++)
+            {
+                int64_t at = (sy + j) * stride + sx;
+                if (f->pixel_size == 1)
+                    sum += fx == 2 ? f->yuv[cidx][at] + f->yuv[cidx][at + 1] : f->yuv[cidx][at];
+                else
+                {
+                    const uint16_t* p = (const uint16_t *)f->yuv[cidx];
+                    sum += fx == 2 ? p[at] + p[at + 1] : p[at];
+                }
+            }
+            sum = (sum + round) >> bits;
+            if (out_pixel_size == 1)
+                o8[x] = (uint8_t)sum;
+            else
+                o16[x] = (uint16_t)sum;
+        }
+    }
+}
+
+/* get_frame_metric for frames of different format; qmctx->i_chroma_format / i_bit_depth is the compare format,
+ * ia_win / ia_ref_win are in compare-format plane coordinates */
+void convert_frame_metric(QMContext* qmctx, Frame* ref, Frame* dst, void* temp, int64_t ssd[], double ssim[])
+{
+    int      width = ref->width[CIDX_Y] > dst->width[CIDX_Y] ? ref->width[CIDX_Y] : dst->width[CIDX_Y];
+    int      ps    = qmctx->i_bit_depth > 8 ? 2 : 1;
+    int      pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+    uint8_t* ref_rows = (uint8_t *)temp + get_ssim_temp_size(width, qmctx->i_bit_depth);
+    uint8_t* dst_rows = ref_rows + CONV_ROWS * width * sizeof(uint16_t);
+    SsimStream ss;
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int* win     = qmctx->ia_win[cidx];
+        int* ref_win = qmctx->ia_ref_win[cidx];
+        int  chroma  = cidx != CIDX_Y;
+        int  ref_fx  = chroma ? cf_sub_x(qmctx->i_chroma_format) / cf_sub_x(ref->chroma_format) : 1;
+        int  ref_fy  = chroma ? cf_sub_y(qmctx->i_chroma_format) / cf_sub_y(ref->chroma_format) : 1;
+        int  dst_fx  = chroma ? cf_sub_x(qmctx->i_chroma_format) / cf_sub_x(dst->chroma_format) : 1;
+        int  dst_fy  = chroma ? cf_sub_y(qmctx->i_chroma_format) / cf_sub_y(dst->chroma_format) : 1;
+
+        ssd[cidx]  = 0;
+        ssim[cidx] = 0;
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        ssim_stream_init(&ss, temp, win[2], ps, pixel_max_value);
+        for (int y = 0; y < win[3]; y += CONV_ROWS)
+        {
+            int rows = win[3] - y < CONV_ROWS ? win[3] - y : CONV_ROWS;
+            convert_rows(ref, cidx, ref_win, ref_fx, ref_fy, ref->bit_depth - qmctx->i_bit_depth, y, rows, ref_rows, ps);
+            convert_rows(dst, cidx, win, dst_fx, dst_fy, dst->bit_depth - qmctx->i_bit_depth, y, rows, dst_rows, ps);
+            if (qmctx->i_metric_method & M_PSNR)
+            {
+                if (ps == 1)
+                    ssd[cidx] += get_block_ssd_8bit(ref_rows, dst_rows, win[2], rows);
+                else
+                    ssd[cidx] += get_block_ssd_10bit((uint16_t *)ref_rows, (uint16_t *)dst_rows, win[2], rows);
+            }
+            if (qmctx->i_metric_method & M_SSIM)
+                ssim_stream_push(&ss, ref_rows, win[2] * ps, dst_rows, win[2] * ps, rows >> 2);
+        }
+        if (qmctx->i_metric_method & M_SSIM)
+            ssim[cidx] = ssim_stream_end(&ss);
+    }
+}
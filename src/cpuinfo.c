@@ -0,0 +1,228 @@
+/**
+ * ===========================================================================
+ * cpuinfo.c
+ * - cpu topology helpers. linux only, other systems report a single node
+ *   and leave threads unpinned
+ * ===========================================================================
+ */
+#ifdef linux
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <pthread.h>
+#endif
+#include "cpuinfo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* "0-7,16-23,32" as used by --affinity and /sys/devices/system/node/node<n>/cpulist */
+int parse_cpu_list(const char* str, CpuSet* set)
+{
+    const char* p = str;
+    set->i_num = 0;
+    while (*p)
+    {
+        char* end;
+        long first = strtol(p, &end, 10), last;
+        if (end == p)
+            break;
+        last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long c = first; c <= last && set->i_num < MAX_CPUS; c++)
+            set->cpus[set->i_num++] = (short)c;
+        while (*p == ',' || *p == ' ' || *p == '\n')
+            p++;
+    }
+    return set->i_num;
+}
+
+void intersect_cpu_set(CpuSet* set, const CpuSet* with)
+{
+    int n = 0;
+    for (int i = 0; i < set->i_num; i++)
+    {
+        for (int j = 0; j < with->i_num; j++)
+        {
+            if (set->cpus[i] == with->cpus[j])
+            {
+                set->cpus[n++] = set->cpus[i];
+                break;
+            }
+        }
+    }
+    set->i_num = n;
+}
+
+/* cpu list of every numa node that has cpus; returns the node count, 0 if the topology is unknown */
+int get_numa_nodes(CpuSet nodes[], int max_nodes)
+{
+    int num = 0;
+#ifdef linux
+    char path[128], line[4096];
+    for (int node = 0; node < 1024 && num < max_nodes; node++)
+    {
+        FILE* f;
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+        f = fopen(path, "r");
+        if (f == NULL)
+        {
+            if (node > 0)  // ids are taken as contiguous: the scan ends at the first missing one after node0
+                break;
+            continue;
+        }
+        if (fgets(line, sizeof(line), f) && parse_cpu_list(line, &nodes[num]) > 0)
+            num++;
+        fclose(f);
+    }
+#else
+    (void)nodes;
+    (void)max_nodes;
+#endif
+    return num;
+}
+
+/* pin the calling thread to set->cpus[index % num], or to the whole set if index < 0 */
+int pin_current_thread(const CpuSet* set, int index)
+{
+#ifdef linux
+    cpu_set_t mask;
+    if (set == NULL || set->i_num == 0)
+        return -1;
+    CPU_ZERO(&mask);
+    if (index >= 0)
+        CPU_SET(set->cpus[index % set->i_num], &mask);
+    else
+    {
+        for (int i = 0; i < set->i_num; i++)
+            CPU_SET(set->cpus[i], &mask);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#else
+    (void)set;
+    (void)index;
+    return -1;
+#endif
+}
+
+#ifdef linux
+/* cpus granted by a cgroup v2 cpu.max ("max 100000" or "400000 100000") or v1 cfs quota file pair, 0 = unlimited */
+static int read_cgroup_quota(const char* dir, int v2)
+{
+    char  path[1100];
+    FILE* f;
+    long long quota = -1, period = 0;
+
+    if (v2)
+    {
+        char max[32];
+        sprintf(path, "%s/cpu.max", dir);
+        if ((f = fopen(path, "r")) == NULL)
+            return -1;
+        if (fscanf(f, "%31s %lld", max, &period) == 2 && strcmp(max, "max"))
+            quota = atoll(max);
+        fclose(f);
+    }
+    else
+    {
+        sprintf(path, "%s/cpu.cfs_quota_us", dir);
+        if ((f = fopen(path, "r")) == NULL)
+            return -1;
+        if (fscanf(f, "%lld", &quota) != 1)
+            quota = -1;
+        fclose(f);
+        sprintf(path, "%s/cpu.cfs_period_us", dir);
+        if ((f = fopen(path, "r")) == NULL)
+            return -1;
+        if (fscanf(f, "%lld", &period) != 1)
+            period = 0;
+        fclose(f);
+    }
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return (int)((quota + period - 1) / period);
+}
+
+/* smallest cpu quota on the path from our cgroup up to the hierarchy root, 0 = unlimited */
+static int get_cgroup_cpu_limit(void)
+{
+    char  line[1024], dir[1024];
+    int   limit = 0;
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        // "0::/user.slice/x" (v2) or "4:cpu,cpuacct:/docker/x" (v1)
+        char* ctrl = strchr(line, ':');
+        char* path = ctrl ? strchr(ctrl + 1, ':') : NULL;
+        int   v2;
+        if (path == NULL)
+            continue;
+        *path++ = 0;
+        ctrl++;
+        path[strcspn(path, "\n")] = 0;
+        v2 = ctrl[0] == 0;
+        if (!v2 && !strstr(ctrl, "cpu,") && strcmp(ctrl, "cpu") && !strstr(ctrl, ",cpu"))
+            continue;
+        if (strcmp(path, "/") == 0)
+            path[0] = 0;
+        for (;;)
+        {
+            int quota = -1;
+            if (v2)
+            {
+                sprintf(dir, "/sys/fs/cgroup%s", path);
+                quota = read_cgroup_quota(dir, 1);
+            }
+            else
+            {
+                sprintf(dir, "/sys/fs/cgroup/cpu,cpuacct%s", path);
+                quota = read_cgroup_quota(dir, 0);
+                if (quota < 0)
+                {
+                    sprintf(dir, "/sys/fs/cgroup/cpu%s", path);
+                    quota = read_cgroup_quota(dir, 0);
+                }
+            }
+            if (quota > 0 && (limit == 0 || quota < limit))
+                limit = quota;
+            char* slash = strrchr(path, '/');
+            if (slash == NULL || path[0] == 0)
+                break;
+            *slash = 0;  // containers usually see their own cgroup as "/", walk up anyway
+        }
+    }
+    fclose(f);
+    return limit;
+}
+#endif
+
+/* worker count for --threads auto: cpus in our affinity mask, capped by the cgroup cpu quota */
+int get_available_cpus(void)
+{
+    int cpus = 1;
+#ifdef linux
+    cpu_set_t mask;
+    int quota;
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+        cpus = CPU_COUNT(&mask);
+    quota = get_cgroup_cpu_limit();
+    if (quota > 0 && quota < cpus)
+        cpus = quota;
+#elif defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    cpus = (int)info.dwNumberOfProcessors;
+#endif
+    return cpus < 1 ? 1 : cpus;
+}
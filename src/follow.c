@@ -0,0 +1,107 @@
+/**
+ * ===========================================================================
+ * follow.c
+ * - sleeps on inotify until the dst file has grown past the end of the next
+ *   frame, so frames are metric'd as they are written and read only once.
+ *   the file is complete on a sentinel file, the encoder's exit or an idle
+ *   timeout; without inotify the size is polled
+ * ===========================================================================
+ */
+#include "follow.h"
+#include <string.h>
+#include <time.h>
+#ifdef linux
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#else
+#include <windows.h>
+#endif
+
+int init_follow(FollowCtx* fctx, QMContext* qmctx)
+{
+    memset(fctx, 0, sizeof(FollowCtx));
+    fctx->i_notify_fd    = -1;
+    fctx->i_idle_timeout = qmctx->i_follow;
+    fctx->i_pid          = qmctx->i_follow_pid;
+    fctx->s_sentinel     = qmctx->s_follow_sentinel;
+#ifdef linux
+    fctx->i_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fctx->i_notify_fd >= 0 && inotify_add_watch(fctx->i_notify_fd, qmctx->s_dst_fname, IN_MODIFY) < 0)
+    {
+        close(fctx->i_notify_fd);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+void close_follow(FollowCtx* fctx)
+{
+#ifdef linux
+    if (fctx->i_notify_fd >= 0)
+        close(fctx->i_notify_fd);
+#endif
+}
+
+/* the writer is done: sentinel file present or encoder process gone */
+static int writer_done(FollowCtx* fctx)
+{
+    FILE* f;
+    if (strlen(fctx->s_sentinel) > 0 && (f = fopen(fctx->s_sentinel, "rb")) != NULL)
+    {
+        fclose(f);
+        return 1;
+    }
+#ifdef linux
+    if (fctx->i_pid > 0 && kill(fctx->i_pid, 0) < 0 && errno == ESRCH)
+        return 1;
+#endif
+    return 0;
+}
+
+/* sleep until the file is written to or FOLLOW_POLL_MS passed */
+static void wait_for_write(FollowCtx* fctx)
+{
+#ifdef linux
+    char events[4096];
+    struct pollfd pfd;
+    if (fctx->i_notify_fd < 0)
+    {
+        usleep(FOLLOW_POLL_MS * 1000);
+        return;
+    }
+    pfd.fd     = fctx->i_notify_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, FOLLOW_POLL_MS) > 0)
+        while (read(fctx->i_notify_fd, events, sizeof(events)) > 0)  // drain, one wake-up per batch of writes
+            ;
+#else
+    Sleep(FOLLOW_POLL_MS);
+#endif
+}
+
+/* block until src holds at least size bytes. 0: they are there, -1: the file is complete and ends before them */
+int follow_wait(FollowCtx* fctx, FrameSource* src, int64_t size)
+{
+    time_t  idle_since = time(NULL);
+    int64_t last_size  = src->i64_file_size;
+
+    while (source_refresh_size(src) < size)
+    {
+        if (writer_done(fctx))  // the last write may have landed between the size check and here
+            return source_refresh_size(src) < size ? -1 : 0;
+        if (src->i64_file_size != last_size)
+        {
+            last_size  = src->i64_file_size;
+            idle_since = time(NULL);
+        }
+        else if (fctx->i_idle_timeout > 0 && time(NULL) - idle_since >= fctx->i_idle_timeout)
+            return -1;
+        wait_for_write(fctx);
+    }
+    return 0;
+}
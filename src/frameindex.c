@@ -0,0 +1,302 @@
+/**
+ * ===========================================================================
+ * frameindex.c
+ * - the index is written once at the end of the run and mapped read-only by
+ *   "query": range sums are two prefix table lookups, min / max walks the
+ *   INDEX_FANOUT-ary tree, O(INDEX_FANOUT * log n) nodes
+ * ===========================================================================
+ */
+#include "frameindex.h"
+#include <string.h>
+#ifdef linux
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+FrameIndex g_frame_index;
+
+void init_frame_index(FrameIndex* fi, QMContext* qmctx)
+{
+    memset(fi, 0, sizeof(FrameIndex));
+    fi->i_enabled = strlen(qmctx->s_index_fname) > 0;
+    pthread_mutex_init(&fi->mtx, NULL);
+}
+
+void frame_index_put(FrameIndex* fi, int pair, int64_t ssd[], double ssim[])
+{
+    if (!fi->i_enabled)
+        return;
+    pthread_mutex_lock(&fi->mtx);
+    if (pair >= fi->i_size)
+    {
+        int          size   = pair + 1 > 2 * fi->i_size ? pair + 1 : 2 * fi->i_size;
+        IndexValues* frames = (IndexValues *)realloc(fi->frames, size * sizeof(IndexValues));
+        char*        valid  = (char *)realloc(fi->valid, size);
+        if (frames)
+            fi->frames = frames;
+        if (valid)
+            fi->valid = valid;
+        if (frames && valid)
+        {
+            memset(fi->valid + fi->i_size, 0, size - fi->i_size);
+            fi->i_size = size;
+        }
+    }
+    if (pair < fi->i_size)
+    {
+        memcpy(fi->frames[pair].ssd, ssd, 3 * sizeof(int64_t));
+        memcpy(fi->frames[pair].ssim, ssim, 3 * sizeof(double));
+        fi->valid[pair] = 1;
+    }
+    pthread_mutex_unlock(&fi->mtx);
+}
+
+static void node_from_values(IndexNode* n, IndexValues* v)
+{
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        n->min[cidx]     = n->max[cidx]     = v->psnr[cidx];
+        n->min[3 + cidx] = n->max[3 + cidx] = v->ssim[cidx];
+    }
+}
+
+static void node_merge(IndexNode* n, IndexNode* c)
+{
+    for (int k = 0; k < 6; k++)
+    {
+        n->min[k] = c->min[k] < n->min[k] ? c->min[k] : n->min[k];
+        n->max[k] = c->max[k] > n->max[k] ? c->max[k] : n->max[k];
+    }
+}
+
+/* frames 0 .. n - 1 where n is the first pair without results */
+int write_frame_index(FrameIndex* fi, QMContext* qmctx)
+{
+    int          pixel_max = (1 << qmctx->i_bit_depth) - 1;
+    IndexHeader  hdr;
+    IndexValues  sum;
+    IndexNode*   level[INDEX_MAX_LEVELS];
+    int64_t      pos;
+    FILE*        f;
+    int          n = 0, ret = 0;
+
+    if (!fi->i_enabled)
+        return 0;
+    while (n < fi->i_size && fi->valid[n])
+        n++;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.i_magic         = INDEX_MAGIC;
+    hdr.i_frames        = n;
+    hdr.i_planes        = qmctx->i_planes;
+    hdr.i_metric_method = qmctx->i_metric_method;
+    hdr.i_bit_depth     = qmctx->i_bit_depth;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        hdr.i64_area[cidx] = (int64_t)qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3];
+    for (int i = 0; i < n; i++)
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+            fi->frames[i].psnr[cidx] = ssd_to_psnr((double)pixel_max * pixel_max * hdr.i64_area[cidx], fi->frames[i].ssd[cidx]);
+
+    // tree levels 1 .. : node i of level l covers nodes (frames) i * INDEX_FANOUT .. of level l - 1
+    hdr.i_levels        = 1;
+    hdr.i_level_size[0] = n;
+    pos = sizeof(IndexHeader) + (2 * (int64_t)n + 1) * sizeof(IndexValues);
+    while (hdr.i_level_size[hdr.i_levels - 1] > 1 && hdr.i_levels < INDEX_MAX_LEVELS)
+    {
+        int l = hdr.i_levels++, size = (hdr.i_level_size[l - 1] + INDEX_FANOUT - 1) / INDEX_FANOUT;
+        hdr.i_level_size[l]  = size;
+        hdr.i64_level_pos[l] = pos;
+        pos += (int64_t)size * sizeof(IndexNode);
+        level[l] = (IndexNode *)malloc(size * sizeof(IndexNode));
+        for (int i = 0; i < size; i++)
+            for (int c = i * INDEX_FANOUT; c < (i + 1) * INDEX_FANOUT && c < hdr.i_level_size[l - 1]; c++)
+            {
+                IndexNode leaf;
+                IndexNode* child = &leaf;
+                if (l == 1)
+                    node_from_values(&leaf, &fi->frames[c]);
+                else
+                    child = &level[l - 1][c];
+                if (c == i * INDEX_FANOUT)
+                    level[l][i] = *child;
+                else
+                    node_merge(&level[l][i], child);
+            }
+    }
+
+    f = fopen(qmctx->s_index_fname, "wb");
+    if (f == NULL)
+        ret = -1;
+    else
+    {
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        fwrite(fi->frames, sizeof(IndexValues), n, f);
+        memset(&sum, 0, sizeof(sum));
+        fwrite(&sum, sizeof(sum), 1, f);
+        for (int i = 0; i < n; i++)
+        {
+            for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+            {
+                sum.ssd[cidx]  += fi->frames[i].ssd[cidx];
+                sum.psnr[cidx] += fi->frames[i].psnr[cidx];
+                sum.ssim[cidx] += fi->frames[i].ssim[cidx];
+            }
+            fwrite(&sum, sizeof(sum), 1, f);
+        }
+        for (int l = 1; l < hdr.i_levels; l++)
+            fwrite(level[l], sizeof(IndexNode), hdr.i_level_size[l], f);
+        ret = fclose(f) == 0 ? 0 : -1;
+    }
+    for (int l = 1; l < hdr.i_levels; l++)
+        free(level[l]);
+    free(fi->frames);
+    free(fi->valid);
+    pthread_mutex_destroy(&fi->mtx);
+    fi->i_enabled = 0;
+    return ret;
+}
+
+/* merge node i of level l into out */
+static void take_node(IndexHeader* hdr, uint8_t* base, int l, int i, IndexNode* out, int* first)
+{
+    IndexNode leaf;
+    IndexNode* n = &leaf;
+    if (l == 0)
+        node_from_values(&leaf, (IndexValues *)(base + sizeof(IndexHeader)) + i);
+    else
+        n = (IndexNode *)(base + hdr->i64_level_pos[l]) + i;
+    if (*first)
+        *out = *n;
+    else
+        node_merge(out, n);
+    *first = 0;
+}
+
+/* min / max over frames [lo, hi): nodes up to the next INDEX_FANOUT boundary on either side are taken one by one,
+ * the whole runs between them one level up */
+static void range_min_max(IndexHeader* hdr, uint8_t* base, int lo, int hi, IndexNode* out)
+{
+    int first = 1;
+    for (int l = 0; lo < hi; l++)
+    {
+        int top = l == hdr->i_levels - 1;
+        while (lo < hi && (top || lo % INDEX_FANOUT))
+            take_node(hdr, base, l, lo++, out, &first);
+        while (lo < hi && hi % INDEX_FANOUT)
+            take_node(hdr, base, l, --hi, out, &first);
+        lo /= INDEX_FANOUT;
+        hi /= INDEX_FANOUT;
+    }
+}
+
+static void print_values(const char* label, double val[], int planes)
+{
+    char str[64];
+    sprint_plane_values(str, val, planes);
+    printf("%-10s%s\n", label, str);
+}
+
+/* query <index> [first-last ...]: 1-based inclusive frame ranges as printed by the run, the whole run if none.
+ * -1 if a range is not within the indexed frames, the other ranges are still answered */
+int query_frame_index(int argc, char** argv)
+{
+    IndexHeader* hdr;
+    uint8_t*     base;
+    int64_t      size;
+    int          ranges = argc > 1 ? argc - 1 : 1;
+    int          ret    = 0;
+
+    if (argc < 1)
+    {
+        printf("Usage: quality_metric.exe query <index file> [first-last ...]\n");
+        return -1;
+    }
+#ifdef linux
+    struct stat st;
+    int fd = open(argv[0], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (int64_t)sizeof(IndexHeader))
+    {
+        fprintf(stderr, "Open index %s error!\n", argv[0]);
+        return -1;
+    }
+    size = st.st_size;
+    base = (uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+#else
+    FILE* f = fopen(argv[0], "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Open index %s error!\n", argv[0]);
+        return -1;
+    }
+    _fseeki64(f, 0, SEEK_END);
+    size = _ftelli64(f);
+    _fseeki64(f, 0, SEEK_SET);
+    base = (uint8_t *)malloc(size);
+    if (base == NULL || fread(base, 1, size, f) != (size_t)size)
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+#endif
+    hdr = (IndexHeader *)base;
+    if (hdr->i_magic != INDEX_MAGIC || hdr->i_levels > INDEX_MAX_LEVELS || hdr->i_levels < 1)
+    {
+        fprintf(stderr, "%s is not a metrics index!\n", argv[0]);
+        return -1;
+    }
+
+    IndexValues* prefix    = (IndexValues *)(base + sizeof(IndexHeader)) + hdr->i_frames;
+    int          pixel_max = (1 << hdr->i_bit_depth) - 1;
+    printf("%s: %d frames\n", argv[0], hdr->i_frames);
+    for (int r = 0; r < ranges; r++)
+    {
+        int       first = 1, last = hdr->i_frames;
+        double    avg_psnr[3], avg_ssim[3], agg_psnr[3], mm[3];
+        IndexNode n;
+        if (argc > 1 && sscanf(argv[r + 1], "%d-%d", &first, &last) != 2)
+            first = last = atoi(argv[r + 1]);
+        if (first < 1 || last > hdr->i_frames || first > last)  // not clamped: a wrong range must not look answered
+        {
+            fprintf(stderr, "frames %s: out of range 1-%d of %s!\n", argc > 1 ? argv[r + 1] : "all", hdr->i_frames, argv[0]);
+            ret = -1;
+            continue;
+        }
+        // sums over first .. last are prefix[last] - prefix[first - 1]
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        {
+            int64_t ssd = prefix[last].ssd[cidx] - prefix[first - 1].ssd[cidx];
+            avg_psnr[cidx] = (prefix[last].psnr[cidx] - prefix[first - 1].psnr[cidx]) / (last - first + 1);
+            avg_ssim[cidx] = (prefix[last].ssim[cidx] - prefix[first - 1].ssim[cidx]) / (last - first + 1);
+            agg_psnr[cidx] = ssd_to_psnr((double)pixel_max * pixel_max * hdr->i64_area[cidx] * (last - first + 1), ssd);
+        }
+        range_min_max(hdr, base, first - 1, last, &n);
+
+        printf("\nframes %d-%d   %s\n", first, last, "Y         U         V");
+        if (hdr->i_metric_method & M_PSNR)
+        {
+            print_values("psnr avg", avg_psnr, hdr->i_planes);
+            print_values("psnr agg", agg_psnr, hdr->i_planes);  // from the summed ssd: mse of the whole range
+            print_values("psnr min", n.min, hdr->i_planes);
+            print_values("psnr max", n.max, hdr->i_planes);
+        }
+        if (hdr->i_metric_method & M_SSIM)
+        {
+            print_values("ssim avg", avg_ssim, hdr->i_planes);
+            memcpy(mm, n.min + 3, sizeof(mm));
+            print_values("ssim min", mm, hdr->i_planes);
+            memcpy(mm, n.max + 3, sizeof(mm));
+            print_values("ssim max", mm, hdr->i_planes);
+        }
+    }
+#ifdef linux
+    munmap(base, size);
+#else
+    free(base);
+#endif
+    return ret;
+}
@@ -0,0 +1,105 @@
+/**
+ * ===========================================================================
+ * framemap.c
+ * - pair i -> ref / dst frame numbers for inputs of different frame rates.
+ *   rates are kept as num / den so 60000/1001 vs 30000/1001 maps exactly;
+ *   frames that are not mapped are never read, the readers fetch by offset
+ * ===========================================================================
+ */
+#include "framemap.h"
+#include "framesource.h"
+#include <stdio.h>
+#include <string.h>
+
+/* "60", "30000/1001" or "29.97" as fps[0] / fps[1], 0 on success */
+int parse_fps(const char* str, int fps[2])
+{
+    double f;
+    if (sscanf(str, "%d/%d", &fps[0], &fps[1]) == 2 && strchr(str, '/'))
+        return fps[0] > 0 && fps[1] > 0 ? 0 : -1;
+    if (sscanf(str, "%lf", &f) != 1 || f <= 0 || f > 1000000)
+        return -1;
+    fps[0] = (int)(f * 1000 + 0.5);
+    fps[1] = 1000;
+    return 0;
+}
+
+int parse_fps_map(const char* str)
+{
+    if (!strcmp(str, "nearest"))
+        return FPS_MAP_NEAREST;
+    if (!strcmp(str, "drop"))
+        return FPS_MAP_DROP;
+    if (!strcmp(str, "repeat"))
+        return FPS_MAP_REPEAT;
+    return -1;
+}
+
+/* frame of an input at rate fps shown at time pair / tl_fps: the last one started, or the closest one */
+static int64_t frame_at(int64_t pair, int fps[2], int tl_fps[2], int nearest)
+{
+    int64_t num = pair * fps[0] * tl_fps[1];
+    int64_t den = (int64_t)fps[1] * tl_fps[0];
+    return nearest ? (2 * num + den) / (2 * den) : num / den;
+}
+
+/* pair of the full run that pair is: the sampled one with --sample, else itself */
+int64_t source_pair(QMContext* qmctx, int64_t pair)
+{
+    return qmctx->ia_sample && pair < qmctx->i_sample_num ? qmctx->ia_sample[pair] : pair;
+}
+
+void map_frame_pair(QMContext* qmctx, int64_t pair, int64_t* ref_frm, int64_t* dst_frm)
+{
+    int* ref_fps = qmctx->ia_ref_fps;
+    int* dst_fps = qmctx->ia_dst_fps;
+    int* tl_fps  = dst_fps;  // rate pairs are taken at
+    int  ref_faster = (int64_t)ref_fps[0] * dst_fps[1] > (int64_t)dst_fps[0] * ref_fps[1];
+
+    pair = source_pair(qmctx, pair);
+    if (qmctx->i_fps_map == FPS_MAP_NONE)
+    {
+        *ref_frm = qmctx->i_ref_skip_num + pair;
+        *dst_frm = qmctx->i_dst_skip_num + pair;
+        return;
+    }
+    if (qmctx->i_fps_map == FPS_MAP_DROP)
+        tl_fps = ref_faster ? dst_fps : ref_fps;
+    else if (qmctx->i_fps_map == FPS_MAP_REPEAT)
+        tl_fps = ref_faster ? ref_fps : dst_fps;
+    *ref_frm = qmctx->i_ref_skip_num + frame_at(pair, ref_fps, tl_fps, qmctx->i_fps_map == FPS_MAP_NEAREST);
+    *dst_frm = qmctx->i_dst_skip_num + frame_at(pair, dst_fps, tl_fps, 0);
+}
+
+/* pairs of the run: the first pair whose mapped frame is past the end of an input ends it */
+int count_frame_pairs(QMContext* qmctx)
+{
+    FrameSource src;
+    Frame       g;
+    int64_t     ref_frames, dst_frames, ref_frm, dst_frm;
+    int         lo = 0, hi = qmctx->i_frame_num;
+
+    if (qmctx->ia_sample)  // the sample is drawn from the pairs in both inputs
+        return qmctx->i_sample_num;
+    init_frame_geometry(&g, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    if (open_frame_source(&src, qmctx->s_ref_fname, 0) < 0)
+        return 0;
+    ref_frames = src.i64_file_size / g.frame_size;
+    close_frame_source(&src);
+    init_frame_geometry(&g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+    if (open_frame_source(&src, qmctx->s_dst_fname, 0) < 0)
+        return 0;
+    dst_frames = src.i64_file_size / g.frame_size;
+    close_frame_source(&src);
+
+    while (lo < hi)  // mapping is monotonic
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        map_frame_pair(qmctx, mid - 1, &ref_frm, &dst_frm);
+        if (ref_frm < ref_frames && dst_frm < dst_frames)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
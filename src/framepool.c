@@ -0,0 +1,141 @@
+/**
+ * ===========================================================================
+ * framepool.c
+ * - aligned, recycled frame buffers
+ * ===========================================================================
+ */
+#include "framepool.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef linux
+#include <sys/mman.h>
+#else
+#include <malloc.h>
+#endif
+
+FramePool g_frame_pool;
+static int g_pool_inited = 0;
+
+void frame_pool_init(FramePool* pool, int hugepages)
+{
+    pool->blocks      = NULL;
+    pool->i_hugepages = hugepages;
+    pool->total_size  = 0;
+    pthread_mutex_init(&pool->mtx, NULL);
+    if (pool == &g_frame_pool)
+        g_pool_inited = 1;
+}
+
+static unsigned char* alloc_block(FramePool* pool, size_t size, int* type)
+{
+    void* buf = NULL;
+#ifdef linux
+    if (pool->i_hugepages && size >= HUGE_PAGE_SIZE)
+    {
+#ifdef MAP_HUGETLB
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buf != MAP_FAILED)
+        {
+            *type = PB_HUGETLB;
+            return (unsigned char *)buf;
+        }
+#endif
+        buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf != MAP_FAILED)
+        {
+#ifdef MADV_HUGEPAGE
+            madvise(buf, size, MADV_HUGEPAGE);
+#endif
+            *type = PB_THP;
+            return (unsigned char *)buf;
+        }
+    }
+    *type = PB_MALLOC;
+    if (posix_memalign(&buf, FRAME_ALIGN, size) != 0)
+        return NULL;
+#else
+    *type = PB_MALLOC;
+    buf = _aligned_malloc(size, FRAME_ALIGN);
+#endif
+    return (unsigned char *)buf;
+}
+
+static void free_block(PoolBlock* blk)
+{
+#ifdef linux
+    if (blk->i_type != PB_MALLOC)
+        munmap(blk->buf, blk->size);
+    else
+        free(blk->buf);
+#else
+    _aligned_free(blk->buf);
+#endif
+}
+
+/* Hand out the smallest free block that holds size bytes, or map a new one.
+ * Blocks come back through frame_pool_release and are reused by later frames of any session. */
+void* frame_pool_alloc(FramePool* pool, size_t size)
+{
+    PoolBlock* best = NULL;
+
+    if (pool == &g_frame_pool && !g_pool_inited)
+        frame_pool_init(pool, 0);
+
+    size = (size + FRAME_ALIGN - 1) & ~(size_t)(FRAME_ALIGN - 1);
+    pthread_mutex_lock(&pool->mtx);
+    for (PoolBlock* blk = pool->blocks; blk; blk = blk->next)
+    {
+        if (!blk->i_in_use && blk->size >= size && (best == NULL || blk->size < best->size))
+            best = blk;
+    }
+    if (best == NULL)
+    {
+        best = (PoolBlock *)malloc(sizeof(PoolBlock));
+        if (pool->i_hugepages && size >= HUGE_PAGE_SIZE)
+            size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        best->buf  = alloc_block(pool, size, &best->i_type);
+        best->size = size;
+        if (best->buf == NULL)
+        {
+            free(best);
+            pthread_mutex_unlock(&pool->mtx);
+            return NULL;
+        }
+        best->next   = pool->blocks;
+        pool->blocks = best;
+        pool->total_size += size;
+    }
+    best->i_in_use = 1;
+    pthread_mutex_unlock(&pool->mtx);
+    return best->buf;
+}
+
+void frame_pool_release(FramePool* pool, void* buf)
+{
+    if (buf == NULL)
+        return;
+    pthread_mutex_lock(&pool->mtx);
+    for (PoolBlock* blk = pool->blocks; blk; blk = blk->next)
+    {
+        if (blk->buf == buf)
+        {
+            blk->i_in_use = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+void frame_pool_destroy(FramePool* pool)
+{
+    PoolBlock* blk = pool->blocks;
+    while (blk)
+    {
+        PoolBlock* next = blk->next;
+        free_block(blk);
+        free(blk);
+        blk = next;
+    }
+    pool->blocks     = NULL;
+    pool->total_size = 0;
+}
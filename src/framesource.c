@@ -0,0 +1,537 @@
+/**
+ * ===========================================================================
+ * framesource.c
+ * - pread / preadv based frame reader: any worker fetches frame N with one
+ *   syscall, no seek state and no stdio buffer copy
+ * - with --io-chunk every storage read is one whole chunk; a global lock lets
+ *   only one chunk read hit the device at a time, so ref and dst are read
+ *   alternately in long sequential runs instead of thrashing between files
+ * - a segmented input is one virtual file: offset -> segment by binary search
+ *   of the prefix table, at most SEG_OPEN_MAX segment files open at a time
+ * ===========================================================================
+ */
+#include "framesource.h"
+#include "framepool.h"
+#include <string.h>
+#include <time.h>
+#ifdef linux
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <glob.h>
+#endif
+#define SEG_NAME_LENGTH 1024
+
+static pthread_mutex_t g_io_mtx = PTHREAD_MUTEX_INITIALIZER;  // one chunk read on the device at a time
+
+static double now_seconds(void)
+{
+#ifdef linux
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static int64_t get_file_size(const char* fname)
+{
+#ifdef linux
+    struct stat st;
+    return stat(fname, &st) == 0 ? st.st_size : -1;
+#else
+    struct _stat64 st;
+    return _stat64(fname, &st) == 0 ? st.st_size : -1;
+#endif
+}
+
+static int add_segment(SegmentList* sl, const char* name, int* cap)
+{
+    if (sl->i_count == *cap)
+    {
+        char** names = (char **)realloc(sl->names, (*cap * 2 + 16) * sizeof(char *));
+        if (names == NULL)
+            return -1;
+        sl->names = names;
+        *cap      = *cap * 2 + 16;
+    }
+    sl->names[sl->i_count] = (char *)malloc(strlen(name) + 1);
+    if (sl->names[sl->i_count] == NULL)
+        return -1;
+    strcpy(sl->names[sl->i_count++], name);
+    return 0;
+}
+
+/* "@list": one segment file per line, blank lines and # comments skipped, relative names are relative to the list */
+static int load_segment_list(SegmentList* sl, const char* list, int* cap)
+{
+    char  line[SEG_NAME_LENGTH], path[2 * SEG_NAME_LENGTH];
+    const char* slash = strrchr(list, '/');
+    int   dir_len = slash ? (int)(slash - list) + 1 : 0;
+    FILE* f = fopen(list, "r");
+    int   ret = 0;
+
+    if (f == NULL)
+        return -1;
+    while (ret == 0 && fgets(line, sizeof(line), f))
+    {
+        int len = (int)strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+            line[--len] = 0;
+        if (len == 0 || line[0] == '#')
+            continue;
+        if (line[0] == '/' || dir_len == 0)
+            ret = add_segment(sl, line, cap);
+        else
+        {
+            snprintf(path, sizeof(path), "%.*s%s", dir_len, list, line);
+            ret = add_segment(sl, path, cap);
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+/* fname is "@list" or, if no such file exists, a glob pattern: fill the segment names and the prefix table.
+ * 0: fname is a plain file, 1: segmented, -1: error or no segments */
+static int open_segments(SegmentList* sl, const char* fname)
+{
+    int cap = 0, ret = 0;
+
+    if (fname[0] == '@')
+        ret = load_segment_list(sl, fname + 1, &cap);
+#ifdef linux
+    else if (strpbrk(fname, "*?[") && get_file_size(fname) < 0)
+    {
+        glob_t g;
+        if (glob(fname, 0, NULL, &g) != 0)  // sorted by name
+            return -1;
+        for (size_t i = 0; i < g.gl_pathc && ret == 0; i++)
+            ret = add_segment(sl, g.gl_pathv[i], &cap);
+        globfree(&g);
+    }
+#endif
+    else
+        return 0;
+    if (ret < 0 || sl->i_count == 0 || (sl->i64_start = (int64_t *)malloc((sl->i_count + 1) * sizeof(int64_t))) == NULL)
+        return -1;
+
+    for (int i = 0; i < SEG_OPEN_MAX; i++)
+        sl->i_open_seg[i] = -1;
+    pthread_mutex_init(&sl->mtx, NULL);
+
+    sl->i64_start[0] = 0;
+    for (int i = 0; i < sl->i_count; i++)
+    {
+        int64_t size = get_file_size(sl->names[i]);
+        if (size < 0)
+        {
+            fprintf(stderr, "Segment %s not found!\n", sl->names[i]);
+            return -1;
+        }
+        sl->i64_start[i + 1] = sl->i64_start[i] + size;
+    }
+    return 1;
+}
+
+static void close_segment_file(SegFile file)
+{
+#ifdef linux
+    close(file);
+#else
+    fclose(file);
+#endif
+}
+
+static void close_segments(SegmentList* sl)
+{
+    for (int i = 0; i < SEG_OPEN_MAX; i++)
+        if (sl->i_open_seg[i] >= 0)
+            close_segment_file(sl->file[i]);
+    for (int i = 0; i < sl->i_count; i++)
+        free(sl->names[i]);
+    free(sl->names);
+    if (sl->i64_start)
+        pthread_mutex_destroy(&sl->mtx);
+    free(sl->i64_start);
+}
+
+/* open file of segment seg, reusing an open one. *slot gets the slot to release, -1 if every slot is busy
+ * and the file is private to this read */
+static int acquire_segment(SegmentList* sl, int seg, SegFile* file, int* slot)
+{
+    int free_slot = -1;
+
+    pthread_mutex_lock(&sl->mtx);
+    for (int i = 0; i < SEG_OPEN_MAX; i++)
+    {
+        int s = (sl->i_next_slot + i) % SEG_OPEN_MAX;
+        if (sl->i_open_seg[s] == seg)
+        {
+            sl->i_users[s]++;
+            *file = sl->file[s];
+            *slot = s;
+            pthread_mutex_unlock(&sl->mtx);
+            return 0;
+        }
+        if (free_slot < 0 && sl->i_users[s] == 0)
+            free_slot = s;
+    }
+    *slot = free_slot;
+    if (free_slot >= 0)
+    {
+        if (sl->i_open_seg[free_slot] >= 0)  // done with: close it so descriptor use stays bounded
+            close_segment_file(sl->file[free_slot]);
+        sl->i_open_seg[free_slot] = -1;
+        sl->i_next_slot = (free_slot + 1) % SEG_OPEN_MAX;
+    }
+#ifdef linux
+    *file = open(sl->names[seg], O_RDONLY);
+    if (*file < 0)
+#else
+    *file = fopen(sl->names[seg], "rb");
+    if (*file == NULL)
+#endif
+    {
+        pthread_mutex_unlock(&sl->mtx);
+        return -1;
+    }
+    if (free_slot >= 0)
+    {
+        sl->file[free_slot]       = *file;
+        sl->i_open_seg[free_slot] = seg;
+        sl->i_users[free_slot]    = 1;
+    }
+    pthread_mutex_unlock(&sl->mtx);
+    return 0;
+}
+
+static void release_segment(SegmentList* sl, SegFile file, int slot)
+{
+    if (slot < 0)
+    {
+        close_segment_file(file);
+        return;
+    }
+    pthread_mutex_lock(&sl->mtx);
+    sl->i_users[slot]--;
+    pthread_mutex_unlock(&sl->mtx);
+}
+
+/* segment holding offset of the virtual file: the last one starting at or before it, empty segments skipped */
+static int find_segment(SegmentList* sl, int64_t offset)
+{
+    int lo = 0, hi = sl->i_count - 1;
+    if (offset < 0 || offset >= sl->i64_start[sl->i_count])
+        return -1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (sl->i64_start[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static int file_read(SegFile file, int64_t offset, char* p, int size)
+{
+#ifdef linux
+    while (size > 0)
+    {
+        ssize_t n = pread(file, p, size, offset);
+        if (n <= 0)
+            return -1;
+        p      += n;
+        offset += n;
+        size   -= (int)n;
+    }
+    return 0;
+#else
+    return _fseeki64(file, offset, SEEK_SET) != 0 || size != (int)fread(p, 1, size, file) ? -1 : 0;
+#endif
+}
+
+/* reads crossing a segment boundary are split, each part goes to its own file */
+static int segment_read(FrameSource* src, int64_t offset, void* buf, int size)
+{
+    SegmentList* sl = &src->seg;
+    char* p = (char *)buf;
+    int   ret = 0;
+
+#ifndef linux
+    pthread_mutex_lock(&src->mtx);  // seek + read pairs of a shared FILE must not interleave
+#endif
+    while (size > 0 && ret == 0)
+    {
+        int     seg = find_segment(sl, offset), slot, n;
+        SegFile file;
+        if (seg < 0 || acquire_segment(sl, seg, &file, &slot) < 0)
+        {
+            ret = -1;
+            break;
+        }
+        n   = (int)(sl->i64_start[seg + 1] - offset < size ? sl->i64_start[seg + 1] - offset : size);
+        ret = file_read(file, offset - sl->i64_start[seg], p, n);
+        release_segment(sl, file, slot);
+        p      += n;
+        offset += n;
+        size   -= n;
+    }
+#ifndef linux
+    pthread_mutex_unlock(&src->mtx);
+#endif
+    return ret;
+}
+
+/* fname: a yuv file, "@list" of segment files or a glob pattern of them.
+ * chunk: staging chunk size in bytes, 0 to read frames straight from the file */
+int open_frame_source(FrameSource* src, const char* fname, int chunk)
+{
+    int segmented;
+    memset(src, 0, sizeof(FrameSource));
+    segmented = open_segments(&src->seg, fname);
+    if (segmented < 0)
+    {
+        close_segments(&src->seg);
+        return -1;
+    }
+    if (segmented)
+        src->i64_file_size = src->seg.i64_start[src->seg.i_count];
+    else
+    {
+#ifdef linux
+        struct stat st;
+        src->fd = open(fname, O_RDONLY);
+        if (src->fd < 0)
+            return -1;
+        if (fstat(src->fd, &st) != 0)
+        {
+            close(src->fd);
+            return -1;
+        }
+        src->i64_file_size = st.st_size;
+#else
+        src->file = fopen(fname, "rb");
+        if (src->file == NULL)
+            return -1;
+        _fseeki64(src->file, 0, SEEK_END);
+        src->i64_file_size = _ftelli64(src->file);
+#endif
+    }
+    pthread_mutex_init(&src->mtx, NULL);
+
+    if (chunk > 0)
+    {
+        for (int i = 0; i < IO_RING_SLOTS; i++)
+        {
+            src->ring[i] = (uint8_t *)frame_pool_alloc(&g_frame_pool, chunk);
+            src->i64_slot_pos[i] = -1;
+            if (src->ring[i] == NULL)
+            {
+                close_frame_source(src);
+                return -1;
+            }
+        }
+        src->i_chunk = chunk;
+    }
+    return 0;
+}
+
+void close_frame_source(FrameSource* src)
+{
+    for (int i = 0; i < IO_RING_SLOTS; i++)
+        if (src->ring[i])
+            frame_pool_release(&g_frame_pool, src->ring[i]);
+    if (src->seg.i_count > 0)
+        close_segments(&src->seg);
+    else
+#ifdef linux
+        close(src->fd);
+#else
+        fclose(src->file);
+#endif
+    pthread_mutex_destroy(&src->mtx);
+}
+
+/* read exactly size bytes at offset from storage, -1 on error or end of file */
+static int device_read(FrameSource* src, int64_t offset, void* buf, int size)
+{
+    if (src->seg.i_count > 0)
+        return segment_read(src, offset, buf, size);
+#ifdef linux
+    return file_read(src->fd, offset, (char *)buf, size);
+#else
+    int ret;
+    pthread_mutex_lock(&src->mtx);
+    ret = file_read(src->file, offset, (char *)buf, size);
+    pthread_mutex_unlock(&src->mtx);
+    return ret;
+#endif
+}
+
+/* stage the chunk holding offset, return its slot; called with src->mtx held */
+static int stage_chunk(FrameSource* src, int64_t offset)
+{
+    int     slot = src->i_next_slot;
+    int64_t pos  = offset / src->i_chunk * src->i_chunk;
+    int     len  = (int)(src->i64_file_size - pos < src->i_chunk ? src->i64_file_size - pos : src->i_chunk);
+    double  start;
+    int     ret;
+
+    pthread_mutex_lock(&g_io_mtx);
+    start = now_seconds();
+    ret   = device_read(src, pos, src->ring[slot], len);
+    src->f_read_time += now_seconds() - start;
+    pthread_mutex_unlock(&g_io_mtx);
+    if (ret < 0)
+    {
+        src->i64_slot_pos[slot] = -1;
+        return -1;
+    }
+    src->i64_bytes_read     += len;
+    src->i64_slot_pos[slot]  = pos;
+    src->i_slot_len[slot]    = len;
+    src->i_next_slot         = (slot + 1) % IO_RING_SLOTS;
+    return slot;
+}
+
+/* read exactly size bytes at offset, -1 on error or end of file */
+int source_read(FrameSource* src, int64_t offset, void* buf, int size)
+{
+    char* p = (char *)buf;
+
+    if (src->i_chunk == 0)
+        return device_read(src, offset, buf, size);
+    if (offset < 0 || offset + size > src->i64_file_size)
+        return -1;
+
+    pthread_mutex_lock(&src->mtx);
+    while (size > 0)
+    {
+        int slot = -1, n;
+        for (int i = 0; i < IO_RING_SLOTS; i++)
+            if (src->i64_slot_pos[i] >= 0 && offset >= src->i64_slot_pos[i] && offset < src->i64_slot_pos[i] + src->i_slot_len[i])
+                slot = i;
+        if (slot < 0 && (slot = stage_chunk(src, offset)) < 0)
+            break;
+        n = (int)(src->i64_slot_pos[slot] + src->i_slot_len[slot] - offset);
+        n = n < size ? n : size;
+        memcpy(p, src->ring[slot] + (offset - src->i64_slot_pos[slot]), n);
+        p      += n;
+        offset += n;
+        size   -= n;
+    }
+    pthread_mutex_unlock(&src->mtx);
+    return size > 0 ? -1 : 0;
+}
+
+#define ROW_IOV 1024  // iovecs per preadv, IOV_MAX on linux
+
+/* rows of one plane, packed in the file, to rows stride bytes apart in memory */
+static int source_read_rows(FrameSource* src, int64_t offset, uint8_t* buf, int stride, int row_size, int rows)
+{
+    if (stride == row_size)
+        return source_read(src, offset, buf, rows * row_size);
+#ifdef linux
+    if (src->i_chunk == 0 && src->seg.i_count == 0)
+    {
+        struct iovec iov[ROW_IOV];
+        while (rows > 0)
+        {
+            int n = rows < ROW_IOV ? rows : ROW_IOV;
+            for (int i = 0; i < n; i++)
+            {
+                iov[i].iov_base = buf + (int64_t)i * stride;
+                iov[i].iov_len  = row_size;
+            }
+            if (preadv(src->fd, iov, n, offset) != (ssize_t)n * row_size)
+                break;  // short read: the rest row by row
+            offset += (int64_t)n * row_size;
+            buf    += (int64_t)n * stride;
+            rows   -= n;
+        }
+    }
+#endif
+    for (; rows > 0; rows--, offset += row_size, buf += stride)
+        if (source_read(src, offset, buf, row_size) < 0)
+            return -1;
+    return 0;
+}
+
+/* the three planes are contiguous in the file but aligned apart in memory: one preadv, or one per
+ * ROW_IOV rows when alloc_frame padded the rows.
+ * planes: mask of (1 << cidx), the others are skipped over and never read.
+ * win: x, y, w, h per plane, only rows y .. y + h - 1 are read (to their place in the frame); NULL: whole planes */
+int source_read_frame(FrameSource* src, Frame* f, int64_t frm_num, int planes, int win[3][4])
+{
+    int64_t offset = frm_num * f->frame_size;
+    int64_t plane_offset[3] = { offset, offset + f->y_size, offset + f->y_size + f->uv_size };
+    int     whole = planes == PLANES_ALL;
+    if (offset + f->frame_size > src->i64_file_size)
+        return -1;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V && win; cidx++)
+        whole &= win[cidx][1] == 0 && win[cidx][3] == f->height[cidx];
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        whole &= f->stride[cidx] == f->width[cidx] * f->pixel_size;
+#ifdef linux
+    if (src->i_chunk == 0 && src->seg.i_count == 0 && whole)
+    {
+        struct iovec iov[3];
+        iov[0].iov_base = f->yuv[CIDX_Y];
+        iov[0].iov_len  = f->y_size;
+        iov[1].iov_base = f->yuv[CIDX_U];
+        iov[1].iov_len  = f->uv_size;
+        iov[2].iov_base = f->yuv[CIDX_V];
+        iov[2].iov_len  = f->uv_size;
+        if (preadv(src->fd, iov, 3, offset) == f->frame_size)
+            return 0;
+    }
+#endif
+    // padded rows, plane subset or window rows, short read, staged chunks (or no preadv): plane by plane
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int row_size = f->width[cidx] * f->pixel_size;
+        int y        = win ? win[cidx][1] : 0;
+        int rows     = win ? win[cidx][3] : f->height[cidx];
+        if ((planes & (1 << cidx))
+            && source_read_rows(src, plane_offset[cidx] + (int64_t)y * row_size, f->yuv[cidx] + (int64_t)y * f->stride[cidx],
+                                f->stride[cidx], row_size, rows) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int source_frame_num(FrameSource* src, Frame* f)
+{
+    return (int)(src->i64_file_size / f->frame_size);
+}
+
+/* --follow: pick up the current size of a file that is still being written */
+int64_t source_refresh_size(FrameSource* src)
+{
+    if (src->seg.i_count > 0)
+        return src->i64_file_size;
+#ifdef linux
+    struct stat st;
+    if (fstat(src->fd, &st) == 0)
+        src->i64_file_size = st.st_size;
+#else
+    pthread_mutex_lock(&src->mtx);
+    if (_fseeki64(src->file, 0, SEEK_END) == 0)
+        src->i64_file_size = _ftelli64(src->file);
+    pthread_mutex_unlock(&src->mtx);
+#endif
+    return src->i64_file_size;
+}
+
+void show_source_stats(FILE* out, const char* name, FrameSource* src)
+{
+    if (src->i_chunk == 0)
+        return;
+    fprintf(out, "%s input: %.1f MB read in %.1f MB chunks, %.3f s, %.1f MB/s\n", name, src->i64_bytes_read / 1048576.0,
+            src->i_chunk / 1048576.0, src->f_read_time, src->f_read_time > 0 ? src->i64_bytes_read / 1048576.0 / src->f_read_time : 0.0);
+}
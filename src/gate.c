@@ -0,0 +1,209 @@
+/**
+ * ===========================================================================
+ * gate.c
+ * - --fail-below: the first frame with a selected plane under the psnr or
+ *   ssim threshold fails the gate. the psnr threshold is turned into an ssd
+ *   budget per plane (i64_ssd_budget), get_frame_metric stops summing a
+ *   plane once its ssd is over it
+ * - --avg-target: with the number of pairs known, the gate fails as soon as
+ *   even perfect remaining frames cannot lift the average to the target,
+ *   and passes early (without --fail-below) once even the worst remaining
+ *   frames cannot pull it under
+ * ===========================================================================
+ */
+#include "gate.h"
+#include "framemap.h"
+#include <math.h>
+#include <string.h>
+
+QualityGate g_gate;
+
+/* "psnr:35", "ssim:0.95" or both comma separated; an unnamed metric stays 0. -1 if invalid */
+int parse_gate(const char* str, double* psnr, double* ssim)
+{
+    char   name[8];
+    double v;
+    int    n;
+
+    while (*str)
+    {
+        if (sscanf(str, "%7[a-z]:%lf%n", name, &v, &n) != 2 || v <= 0)
+            return -1;
+        if (!strcmp(name, "psnr"))
+            *psnr = v;
+        else if (!strcmp(name, "ssim"))
+            *ssim = v;
+        else
+            return -1;
+        str += n;
+        if (*str == ',')
+            str++;
+        else if (*str)
+            return -1;
+    }
+    return 0;
+}
+
+int init_gate(QualityGate* gate, QMContext* qmctx)
+{
+    int pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+
+    memset(gate, 0, sizeof(QualityGate));
+    gate->i_pairs = qmctx->i_follow ? 0 : count_frame_pairs(qmctx);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        double max_ssd = (double)pixel_max_value * pixel_max_value * qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3];
+        qmctx->i64_ssd_budget[cidx] = 0;
+        // ssd above the budget is psnr under the threshold; +1 keeps rounding at the boundary on the side of computing
+        if ((qmctx->i_planes & (1 << cidx)) && qmctx->f_fail_psnr > 0 && qmctx->f_fail_psnr < GATE_MAX_PSNR)
+            qmctx->i64_ssd_budget[cidx] = (int64_t)(max_ssd / pow(10.0, qmctx->f_fail_psnr / 10.0)) + 1;
+    }
+    pthread_mutex_init(&gate->mtx, NULL);
+    gate->i_enabled = 1;
+    return 0;
+}
+
+static void decide(QualityGate* gate, int verdict, const char* reason)
+{
+    gate->i_verdict = verdict;
+    snprintf(gate->s_reason, sizeof(gate->s_reason), "%s", reason);
+}
+
+/* average targets against the best and the worst the frames not counted yet can do */
+static void check_averages(QualityGate* gate, QMContext* qmctx)
+{
+    int    left     = gate->i_pairs - gate->i_frames;
+    int    can_pass = !(qmctx->f_fail_psnr > 0 || qmctx->f_fail_ssim > 0);  // a later frame could still fail
+    char   reason[256];
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        if (qmctx->f_avg_psnr > 0)
+        {
+            if ((gate->sum_psnr[cidx] + left * GATE_MAX_PSNR) / gate->i_pairs < qmctx->f_avg_psnr)
+            {
+                snprintf(reason, sizeof(reason), "plane %s average psnr cannot reach %.4f after %d of %d frames",
+                         plane_name[cidx], qmctx->f_avg_psnr, gate->i_frames, gate->i_pairs);
+                decide(gate, GATE_VERDICT_FAIL, reason);
+                return;
+            }
+            can_pass &= gate->sum_psnr[cidx] / gate->i_pairs >= qmctx->f_avg_psnr;  // remaining frames at psnr 0
+        }
+        if (qmctx->f_avg_ssim > 0)
+        {
+            if ((gate->sum_ssim[cidx] + left * 1.0) / gate->i_pairs < qmctx->f_avg_ssim)
+            {
+                snprintf(reason, sizeof(reason), "plane %s average ssim cannot reach %.4f after %d of %d frames",
+                         plane_name[cidx], qmctx->f_avg_ssim, gate->i_frames, gate->i_pairs);
+                decide(gate, GATE_VERDICT_FAIL, reason);
+                return;
+            }
+            can_pass &= (gate->sum_ssim[cidx] + left * GATE_MIN_SSIM) / gate->i_pairs >= qmctx->f_avg_ssim;
+        }
+    }
+    if (can_pass)
+    {
+        snprintf(reason, sizeof(reason), "averages reach their targets whatever the last %d frames are", left);
+        decide(gate, GATE_VERDICT_PASS, reason);
+    }
+}
+
+/* count the metrics of pair into the gate. GATE_PARTIAL: a plane's ssd stopped at its budget */
+int gate_frame(QualityGate* gate, QMContext* qmctx, int pair, int64_t ssd[], double ssim[])
+{
+    int    pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+    double pixel_max_ssd   = (double)pixel_max_value * pixel_max_value;
+    int    partial = 0, ret;
+    char   reason[256];
+
+    if (!gate->i_enabled)
+        return GATE_OPEN;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        partial |= (qmctx->i_metric_method & M_PSNR) && qmctx->i64_ssd_budget[cidx] > 0 && ssd[cidx] > qmctx->i64_ssd_budget[cidx];
+
+    pthread_mutex_lock(&gate->mtx);
+    if (gate->i_verdict != GATE_VERDICT_NONE)  // frames in flight when the verdict fell
+    {
+        pthread_mutex_unlock(&gate->mtx);
+        return partial ? GATE_PARTIAL : GATE_DECIDED;
+    }
+    for (int cidx = CIDX_Y; cidx <= CIDX_V && gate->i_verdict == GATE_VERDICT_NONE; cidx++)
+    {
+        double psnr = ssd_to_psnr(pixel_max_ssd * qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3], ssd[cidx]);
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        if ((qmctx->i_metric_method & M_PSNR) && qmctx->f_fail_psnr > 0 && psnr < qmctx->f_fail_psnr)
+        {
+            if (qmctx->i64_ssd_budget[cidx] > 0 && ssd[cidx] > qmctx->i64_ssd_budget[cidx])
+                snprintf(reason, sizeof(reason), "frame %d plane %s psnr below %.4f", (int)source_pair(qmctx, pair) + 1, plane_name[cidx], qmctx->f_fail_psnr);
+            else
+                snprintf(reason, sizeof(reason), "frame %d plane %s psnr %.4f below %.4f", (int)source_pair(qmctx, pair) + 1, plane_name[cidx], psnr, qmctx->f_fail_psnr);
+            decide(gate, GATE_VERDICT_FAIL, reason);
+        }
+        else if ((qmctx->i_metric_method & M_SSIM) && qmctx->f_fail_ssim > 0 && ssim[cidx] < qmctx->f_fail_ssim)
+        {
+            snprintf(reason, sizeof(reason), "frame %d plane %s ssim %.4f below %.4f", (int)source_pair(qmctx, pair) + 1, plane_name[cidx], ssim[cidx], qmctx->f_fail_ssim);
+            decide(gate, GATE_VERDICT_FAIL, reason);
+        }
+    }
+    if (!partial)
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        {
+            gate->sum_psnr[cidx] += ssd_to_psnr(pixel_max_ssd * qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3], ssd[cidx]);
+            gate->sum_ssim[cidx] += ssim[cidx];
+        }
+        gate->i_frames++;
+        if (gate->i_verdict == GATE_VERDICT_NONE && gate->i_pairs > 0 && (qmctx->f_avg_psnr > 0 || qmctx->f_avg_ssim > 0))
+            check_averages(gate, qmctx);
+    }
+    ret = partial ? GATE_PARTIAL : (gate->i_verdict != GATE_VERDICT_NONE ? GATE_DECIDED : GATE_OPEN);
+    pthread_mutex_unlock(&gate->mtx);
+    return ret;
+}
+
+int gate_decided(QualityGate* gate)
+{
+    return gate->i_enabled && gate->i_verdict != GATE_VERDICT_NONE;
+}
+
+/* the verdict stopped the run before frames, the frames the run counted, covered every pair: with threads
+ * those are the ones that happened to finish, so their average depends on timing and is not printed */
+int gate_cut_short(QualityGate* gate, int frames)
+{
+    return gate_decided(gate) && (gate->i_pairs == 0 || frames < gate->i_pairs);
+}
+
+/* verdict of the finished or stopped run: the averages decide if no frame did. returns the exit code */
+int gate_verdict(QualityGate* gate, QMContext* qmctx, FILE* out)
+{
+    char reason[256];
+
+    if (gate->i_verdict == GATE_VERDICT_NONE)
+    {
+        decide(gate, GATE_VERDICT_PASS, "all frames and averages meet the thresholds");
+        for (int cidx = CIDX_Y; cidx <= CIDX_V && gate->i_frames > 0; cidx++)
+        {
+            double avg_psnr = gate->sum_psnr[cidx] / gate->i_frames;
+            double avg_ssim = gate->sum_ssim[cidx] / gate->i_frames;
+            if (!(qmctx->i_planes & (1 << cidx)))
+                continue;
+            if (qmctx->f_avg_psnr > 0 && avg_psnr < qmctx->f_avg_psnr)
+            {
+                snprintf(reason, sizeof(reason), "plane %s average psnr %.4f below %.4f", plane_name[cidx], avg_psnr, qmctx->f_avg_psnr);
+                decide(gate, GATE_VERDICT_FAIL, reason);
+                break;
+            }
+            if (qmctx->f_avg_ssim > 0 && avg_ssim < qmctx->f_avg_ssim)
+            {
+                snprintf(reason, sizeof(reason), "plane %s average ssim %.4f below %.4f", plane_name[cidx], avg_ssim, qmctx->f_avg_ssim);
+                decide(gate, GATE_VERDICT_FAIL, reason);
+                break;
+            }
+        }
+    }
+    fprintf(out, "gate: %s, %s\n", gate->i_verdict == GATE_VERDICT_FAIL ? "FAIL" : "PASS", gate->s_reason);
+    return gate->i_verdict == GATE_VERDICT_FAIL ? GATE_EXIT_FAIL : GATE_EXIT_PASS;
+}
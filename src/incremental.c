@@ -0,0 +1,170 @@
+/**
+ * ===========================================================================
+ * incremental.c
+ * - a plane window is cut into bands of 4 rows, one ssim block row each.
+ *   a band whose rows compare equal to the previous frame in ref and dst
+ *   keeps its ssd and block sums; an ssim row is recomputed only if one of
+ *   its two block rows changed
+ * - ssd adds up as integers and the ssim rows are added in ssim_plane order,
+ *   so the results are bit-exact with get_frame_metric
+ * - the previous frame is the one this state saw last: consecutive frames
+ *   only on the single-thread path and within a --batch job
+ * ===========================================================================
+ */
+#include "incremental.h"
+#include <string.h>
+
+IncStats g_inc_stats;
+
+void init_inc_stats(IncStats* is)
+{
+    memset(is, 0, sizeof(IncStats));
+    pthread_mutex_init(&is->mtx, NULL);
+    is->i_enabled = 1;
+}
+
+void show_inc_stats(FILE* out, IncStats* is)
+{
+    if (!is->i_enabled)
+        return;
+    fprintf(out, "incremental: %lld of %lld bands reused (%.1f%%)\n", (long long)is->i64_reused, (long long)is->i64_bands,
+            is->i64_bands ? 100.0 * is->i64_reused / is->i64_bands : 0.0);
+}
+
+int init_inc_state(IncState* st, QMContext* qmctx)
+{
+    int pixel_size = qmctx->i_bit_depth > 8 ? 2 : 1;
+
+    memset(st, 0, sizeof(IncState));
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        IncPlane* pl = &st->planes[cidx];
+        int       w  = qmctx->ia_win[cidx][2], h = qmctx->ia_win[cidx][3];
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        pl->i_row_bytes  = w * pixel_size;
+        pl->i_bands      = (h + 3) >> 2;
+        pl->i_sums_bytes = (w >> 2) * (pixel_size > 1 ? sizeof(int64_t[4]) : sizeof(int[4]));
+        pl->prev_ref     = (uint8_t *)calloc((size_t)pl->i_row_bytes * h, 1);
+        pl->prev_dst     = (uint8_t *)calloc((size_t)pl->i_row_bytes * h, 1);
+        pl->band_ssd     = (int64_t *)malloc(pl->i_bands * sizeof(int64_t));
+        pl->band_sums    = (uint8_t *)malloc((size_t)pl->i_bands * pl->i_sums_bytes);
+        pl->row_ssim     = (float *)malloc(pl->i_bands * sizeof(float));
+        pl->changed      = (char *)malloc(pl->i_bands);
+        if (!pl->prev_ref || !pl->prev_dst || !pl->band_ssd || !pl->band_sums || !pl->row_ssim || !pl->changed)
+            return -1;
+    }
+    return 0;
+}
+
+void free_inc_state(IncState* st)
+{
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        IncPlane* pl = &st->planes[cidx];
+        free(pl->prev_ref);
+        free(pl->prev_dst);
+        free(pl->band_ssd);
+        free(pl->band_sums);
+        free(pl->row_ssim);
+        free(pl->changed);
+    }
+    memset(st, 0, sizeof(IncState));
+}
+
+/* rows of the band equal to the previous frame; copies them over it if not */
+static int band_unchanged(uint8_t* cur, int stride, uint8_t* prev, int row_bytes, int rows)
+{
+    int r;
+    for (r = 0; r < rows; r++)
+        if (memcmp(cur + (int64_t)r * stride, prev + (int64_t)r * row_bytes, row_bytes))
+            break;
+    if (r == rows)
+        return 1;
+    for (; r < rows; r++)
+        memcpy(prev + (int64_t)r * row_bytes, cur + (int64_t)r * stride, row_bytes);
+    return 0;
+}
+
+static void inc_plane_metric(IncState* st, IncPlane* pl, QMContext* qmctx, uint8_t* p_ref, int ref_stride,
+                             uint8_t* p_dst, int dst_stride, int w, int h, int pixel_size, int64_t* ssd, double* ssim)
+{
+    int     blk_rows = h >> 2;
+    int     reused   = 0;
+    float   sum      = 0.0;
+    int64_t total    = 0;
+
+    for (int z = 0; z < pl->i_bands; z++)
+    {
+        int      rows   = h - 4 * z < 4 ? h - 4 * z : 4;
+        uint8_t* ref    = p_ref + (int64_t)4 * z * ref_stride;
+        uint8_t* dst    = p_dst + (int64_t)4 * z * dst_stride;
+        uint8_t* prev_r = pl->prev_ref + (int64_t)4 * z * pl->i_row_bytes;
+        uint8_t* prev_d = pl->prev_dst + (int64_t)4 * z * pl->i_row_bytes;
+        // both comparisons run so that both copies stay current
+        int      same_r = band_unchanged(ref, ref_stride, prev_r, pl->i_row_bytes, rows);
+        int      same_d = band_unchanged(dst, dst_stride, prev_d, pl->i_row_bytes, rows);
+
+        pl->changed[z] = !st->i_valid || !(same_r && same_d);
+        if (!pl->changed[z])
+        {
+            reused++;
+            continue;
+        }
+        if (qmctx->i_metric_method & M_PSNR)
+        {
+            if (pixel_size == 1)
+                pl->band_ssd[z] = get_block_ssd_8bit_stride(ref, ref_stride, dst, dst_stride, w, rows);
+            else
+                pl->band_ssd[z] = get_block_ssd_10bit_stride((uint16_t*)ref, ref_stride >> 1, (uint16_t*)dst, dst_stride >> 1, w, rows);
+        }
+        if ((qmctx->i_metric_method & M_SSIM) && z < blk_rows)
+            ssim_block_row(ref, ref_stride, dst, dst_stride, pl->band_sums + (int64_t)z * pl->i_sums_bytes, w, pixel_size);
+    }
+
+    if (qmctx->i_metric_method & M_PSNR)
+    {
+        for (int z = 0; z < pl->i_bands; z++)
+            total += pl->band_ssd[z];
+        *ssd = total;
+    }
+    if (qmctx->i_metric_method & M_SSIM)
+    {
+        for (int y = 1; y < blk_rows; y++)
+        {
+            if (pl->changed[y - 1] || pl->changed[y])
+                pl->row_ssim[y] = ssim_block_row_end(pl->band_sums + (int64_t)y * pl->i_sums_bytes,
+                                                     pl->band_sums + (int64_t)(y - 1) * pl->i_sums_bytes,
+                                                     w, pixel_size, (1 << qmctx->i_bit_depth) - 1);
+            sum += pl->row_ssim[y];
+        }
+        *ssim = sum / ((blk_rows - 1) * ((w >> 2) - 1));
+    }
+
+    pthread_mutex_lock(&g_inc_stats.mtx);
+    g_inc_stats.i64_bands  += pl->i_bands;
+    g_inc_stats.i64_reused += reused;
+    pthread_mutex_unlock(&g_inc_stats.mtx);
+}
+
+/* get_frame_metric against the previous frame of this state: only bands that changed in ref or dst are computed */
+void inc_frame_metric(IncState* st, QMContext* qmctx, Frame* ref, Frame* dst, int64_t ssd[], double ssim[])
+{
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int*  win        = qmctx->ia_win[cidx];
+        int*  ref_win    = qmctx->ia_ref_win[cidx];
+        int   ref_stride = ref->stride[cidx];
+        int   dst_stride = dst->stride[cidx];
+        uint8_t* p_ref   = ref->yuv[cidx] + (int64_t)ref_win[1] * ref_stride + ref_win[0] * ref->pixel_size;
+        uint8_t* p_dst   = dst->yuv[cidx] + (int64_t)win[1] * dst_stride + win[0] * dst->pixel_size;
+
+        ssd[cidx]  = 0;
+        ssim[cidx] = 0;
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        inc_plane_metric(st, &st->planes[cidx], qmctx, p_ref, ref_stride, p_dst, dst_stride, win[2], win[3],
+                         ref->pixel_size, &ssd[cidx], &ssim[cidx]);
+    }
+    st->i_valid = 1;
+}
@@ -4,6 +4,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "threadpool.h"
+#include "stripe.h"
+#include "stream.h"
+#include "planner.h"
+#include "framepool.h"
+#include "framesource.h"
+#include "roi.h"
+#include "align.h"
+#include "scaler.h"
+#include "framemap.h"
+#include "follow.h"
+#include "cache.h"
+#include "frameindex.h"
+#include "ssimref.h"
+#include "incremental.h"
+#include "bitexact.h"
+#include "gate.h"
+#include "sampling.h"
 #include <string.h>
 #ifdef linux
 #include <unistd.h>
@@ -20,15 +37,23 @@ enum
 
 typedef struct _threadCtx
 {
-    FILE*      ref_file;
-    FILE*      dst_file;
+    FrameSource* ref_src;   // shared by all thread contexts
+    FrameSource* dst_src;
     Frame      ref_frame;
     Frame      dst_frame;
+    StreamCtx  stctx;       // used instead of ref_frame / dst_frame buffers in stripe streaming mode
     double     frame_psnr[3];
     double     frame_ssim[3];
     int*       temp;
     QMContext* qmctx;
     int        i_proc_frm_num;
+    int        i_batch_len;     // frames of the current batch job
+    uint8_t*   ref_slab;        // --batch: i_batch frames read with one call per input
+    uint8_t*   dst_slab;
+    char*      batch_str;       // result lines of the batch, printed together
+    Frame      scaled_frame;    // --scale: the resampled side of the pair
+    void*      scale_temp;
+    IncState   inc;             // --incremental: previous frame metric'd by this context
     volatile int i_status;
     pthread_mutex_t mtx;
     threadpool_t*   p_pool;
@@ -41,6 +66,17 @@ void show_parameters(QMContext* qmctx)
     fprintf(out_file, "dst yuv:            %s\n", qmctx->s_dst_fname);
     fprintf(out_file, "width     / height       / bit_depth    / chroma_format :  %5d / %5d / %5d / %5s\n", 
            qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, cf_name[qmctx->i_chroma_format]);
+    if (qmctx->i_ref_width != qmctx->ia_width[CIDX_Y] || qmctx->i_ref_height != qmctx->ia_height[CIDX_Y]
+        || qmctx->ia_ref_offset[0] || qmctx->ia_ref_offset[1])
+        fprintf(out_file, "ref width / ref height   / ref offset                   :  %5d / %5d / %d,%d\n",
+               qmctx->i_ref_width, qmctx->i_ref_height, qmctx->ia_ref_offset[0], qmctx->ia_ref_offset[1]);
+    if (qmctx->i_convert)
+        fprintf(out_file, "ref / dst bit_depth      / ref / dst chroma_format      :  %5d / %5d / %5s / %5s\n",
+               qmctx->i_ref_bit_depth, qmctx->i_dst_bit_depth, cf_name[qmctx->i_ref_chroma_format], cf_name[qmctx->i_dst_chroma_format]);
+    if (qmctx->i_fps_map != FPS_MAP_NONE)
+        fprintf(out_file, "ref fps   / dst fps      / fps map                      :  %5.3f / %5.3f / %s\n",
+               (double)qmctx->ia_ref_fps[0] / qmctx->ia_ref_fps[1], (double)qmctx->ia_dst_fps[0] / qmctx->ia_dst_fps[1],
+               qmctx->i_fps_map == FPS_MAP_NEAREST ? "nearest" : qmctx->i_fps_map == FPS_MAP_DROP ? "drop" : "repeat");
     fprintf(out_file, "frame_num / ref_skip_num / dst_skip_num / auto_skip     :  %5d / %5d / %5d / %5d\n", 
            qmctx->i_frame_num, qmctx->i_ref_skip_num, qmctx->i_dst_skip_num, qmctx->i_auto_skip);
     fprintf(out_file, "threads   / metric_method/ version                      :  %5d / %5d / %d.%d.%d.%d\n\n", 
@@ -107,67 +143,176 @@ int parse_cmds(int argc, char**argv, QMContext* qmctx)
             OPT("height")                qmctx->ia_height[CIDX_Y] = atoi(optarg);
             OPT("frames")                qmctx->i_frame_num = atoi(optarg);
             OPT("chroma-format")         qmctx->i_chroma_format = atoi(optarg);
-            OPT("threads")               qmctx->i_threads = atoi(optarg);
+            OPT("threads")               qmctx->i_threads = strcmp(optarg, "auto") ? atoi(optarg) : 0;
             OPT("ref-skip-num")          qmctx->i_ref_skip_num = atoi(optarg);
             OPT("dst-skip-num")          qmctx->i_dst_skip_num = atoi(optarg);
             OPT("auto-skip")             qmctx->i_auto_skip = atoi(optarg);
             OPT("threads")               qmctx->i_threads = atoi(optarg);
             OPT("metric-method")         qmctx->i_metric_method = atoi(optarg);
+            OPT("stripes")               qmctx->i_stripes = atoi(optarg);
+            OPT("stream-rows")           qmctx->i_stream_rows = atoi(optarg);
+            OPT("max-memory")            qmctx->i64_max_memory = parse_mem_size(optarg);
+            OPT("hugepages")             qmctx->i_hugepages = atoi(optarg);
+            OPT("affinity")              sprintf(qmctx->s_affinity, "%s", optarg);
+            OPT("numa")                  qmctx->i_numa = atoi(optarg);
+            OPT("io-chunk")
+            {
+                int64_t size = parse_mem_size(optarg);
+                qmctx->i_io_chunk = (int)(size < MAX_IO_CHUNK ? size : MAX_IO_CHUNK);
+            }
+            OPT("planes")                qmctx->i_planes = parse_planes(optarg);
+            OPT("roi")
+            {
+                qmctx->i_roi_auto = !strcmp(optarg, "auto");
+                if (!qmctx->i_roi_auto && parse_roi(optarg, qmctx->ia_roi) < 0)
+                    qmctx->ia_roi[2] = -1;
+            }
+            OPT("ref-width")             qmctx->i_ref_width = atoi(optarg);
+            OPT("ref-height")            qmctx->i_ref_height = atoi(optarg);
+            OPT("ref-offset")
+            {
+                if (sscanf(optarg, "%d,%d", &qmctx->ia_ref_offset[0], &qmctx->ia_ref_offset[1]) != 2)
+                    qmctx->ia_ref_offset[0] = qmctx->ia_ref_offset[1] = 0;
+            }
+            OPT("align")                 qmctx->i_align = atoi(optarg);
+            OPT("scale")                 qmctx->i_scale = parse_scale_method(optarg);
+            OPT("scale-to")              qmctx->i_scale_target = strcmp(optarg, "dst") ? SCALE_TO_REF : SCALE_TO_DST;
+            OPT("ref-bitdepth")          qmctx->i_ref_bit_depth = atoi(optarg);
+            OPT("dst-bitdepth")          qmctx->i_dst_bit_depth = atoi(optarg);
+            OPT("ref-chroma-format")     qmctx->i_ref_chroma_format = atoi(optarg);
+            OPT("dst-chroma-format")     qmctx->i_dst_chroma_format = atoi(optarg);
+            OPT("ref-fps")
+            {
+                if (parse_fps(optarg, qmctx->ia_ref_fps) < 0)
+                    qmctx->ia_ref_fps[0] = -1;
+            }
+            OPT("dst-fps")
+            {
+                if (parse_fps(optarg, qmctx->ia_dst_fps) < 0)
+                    qmctx->ia_dst_fps[0] = -1;
+            }
+            OPT("fps-map")               qmctx->i_fps_map = parse_fps_map(optarg);
+            OPT("follow")                qmctx->i_follow = atoi(optarg);
+            OPT("follow-pid")            qmctx->i_follow_pid = atoi(optarg);
+            OPT("follow-sentinel")       sprintf(qmctx->s_follow_sentinel, "%s", optarg);
+            OPT("cache")                 sprintf(qmctx->s_cache_dir, "%s", optarg);
+            OPT("index")                 sprintf(qmctx->s_index_fname, "%s", optarg);
+            OPT("ssim-ref")              sprintf(qmctx->s_ssim_ref_fname, "%s", optarg);
+            OPT("incremental")           qmctx->i_incremental = atoi(optarg);
+            OPT("bitexact")              qmctx->i_bitexact = atoi(optarg);
+            OPT("fail-below")
+            {
+                if (parse_gate(optarg, &qmctx->f_fail_psnr, &qmctx->f_fail_ssim) < 0)
+                    qmctx->f_fail_psnr = -1;
+            }
+            OPT("avg-target")
+            {
+                if (parse_gate(optarg, &qmctx->f_avg_psnr, &qmctx->f_avg_ssim) < 0)
+                    qmctx->f_avg_psnr = -1;
+            }
+            OPT("sample")
+            {
+                if (parse_sample(optarg, qmctx) < 0)
+                    qmctx->i_sample = -1;
+            }
+            OPT("ci-stop")               qmctx->f_ci_stop = atof(optarg) > 0 ? atof(optarg) : -1;
+            OPT("batch")                 qmctx->i_batch = strcmp(optarg, "auto") ? atoi(optarg) : 0;
         }
     }
     return 0;
 }
 
 
+/* rows of the compared window, read straight into place; whole frames when one side is resampled or converted */
+#define READ_WIN(qmctx, win) ((qmctx)->i_scale || (qmctx)->i_convert ? NULL : (qmctx)->win)
+
+/* --scale: frame at the geometry the other side is resampled to, and the scaler's scratch buffer */
+int alloc_scaled_frame(Frame* scaled, void** scale_temp)
+{
+    Frame* g = &g_scaler.dst_geom;
+    if (alloc_frame(scaled, g->width[CIDX_Y], g->height[CIDX_Y], g->bit_depth, g->chroma_format) < 0)
+        return -1;
+    *scale_temp = malloc(get_scaler_temp_size(&g_scaler));
+    return *scale_temp ? 0 : -1;
+}
+
+/* --scale: replace the side of the pair that is resampled by its resampled copy */
+void resample_pair(QMContext* qmctx, Frame** ref, Frame** dst, Frame* scaled, void* scale_temp)
+{
+    if (qmctx->i_scale == SCALE_NONE)
+        return;
+    if (qmctx->i_scale_target == SCALE_TO_REF)
+    {
+        scale_frame(&g_scaler, *dst, scaled, qmctx->i_planes, scale_temp);
+        *dst = scaled;
+    }
+    else
+    {
+        scale_frame(&g_scaler, *ref, scaled, qmctx->i_planes, scale_temp);
+        *ref = scaled;
+    }
+}
+
 int process_quality_metric_singlethread(QMContext* qmctx)
 {
-    FILE* ref_file, *dst_file, *out_file = qmctx->out_file;
-    Frame ref_frame, dst_frame;
+    FILE* out_file = qmctx->out_file;
+    FrameSource ref_src, dst_src;
+    FollowCtx   fctx;
+    Frame ref_frame, dst_frame, scaled_frame;
+    Frame *p_ref, *p_dst;
+    void*   scale_temp = NULL;
     int64_t frame_ssd[3];
+    int64_t ref_frm, dst_frm;
+    int     cached, gate;
     double  frame_psnr[3], frame_ssim[3];
     double  avg_psnr[3] = { 0.0, 0.0, 0.0 }, avg_ssim[3] = { 0.0, 0.0, 0.0 };
     double  pixel_max_ssd = 0;
+    char    values_str[64];
     double  progress = 0;
     int*    temp;
     int     size_temp;
+    threadpool_t* threadp = NULL;
+    StripeCtx     sctx;
+    StreamCtx     stctx;
+    IncState      inc;
+    CpuSet        affinity;
     int     srcfile_total_frms = 0, dstfile_total_frms = 0, max_avail_frames = 0;
     int i;
 
-    ref_file = fopen(qmctx->s_ref_fname, "rb");
-    if (NULL == ref_file)
+    if (open_frame_source(&ref_src, qmctx->s_ref_fname, qmctx->i_io_chunk) < 0)
     {
         fprintf(stderr, "Open ref yuv file %s error!\n", qmctx->s_ref_fname);
         return -1;
     }
-    dst_file = fopen(qmctx->s_dst_fname, "rb");
-    if (NULL == ref_file)
+    if (open_frame_source(&dst_src, qmctx->s_dst_fname, qmctx->i_io_chunk) < 0)
     {
         fprintf(stderr, "Open dst yuv file %s error!\n", qmctx->s_dst_fname);
         return -1;
     }
 
-    alloc_frame(&ref_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
-    alloc_frame(&dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
-
-    srcfile_total_frms = get_file_frame_num(ref_file, &ref_frame);
-    dstfile_total_frms = get_file_frame_num(dst_file, &dst_frame);
-    max_avail_frames   = srcfile_total_frms < dstfile_total_frms ? dstfile_total_frms : srcfile_total_frms;
-    max_avail_frames   = max_avail_frames < qmctx->i_frame_num ? max_avail_frames : qmctx->i_frame_num;
-    fprintf(out_file, "Reference file contain %d frames, Dst file contain %d frames!\n", srcfile_total_frms, dstfile_total_frms);
-
-    if (jump_to_frame(ref_file, ref_frame.frame_size, qmctx->i_ref_skip_num) < 0)
+    if (qmctx->i_stream_rows > 0)
     {
-        fprintf(stderr, "Ref yuv jump to %d frame failed!\n", qmctx->i_ref_skip_num);
-        return 0;
+        init_frame_geometry(&ref_frame, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+        init_frame_geometry(&dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+        if (init_stream_context(&stctx, qmctx, qmctx->i_stream_rows) < 0)
+        {
+            fprintf(stderr, "Alloc stream buffers failed!\n");
+            return -1;
+        }
     }
-    if (jump_to_frame(dst_file, dst_frame.frame_size, qmctx->i_dst_skip_num) < 0)
+    else
     {
-        fprintf(stderr, "Dst yuv jump to %d frame failed!\n", qmctx->i_dst_skip_num);
-        return 0;
+        alloc_frame(&ref_frame, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+        alloc_frame(&dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
     }
 
+    srcfile_total_frms = source_frame_num(&ref_src, &ref_frame);
+    dstfile_total_frms = source_frame_num(&dst_src, &dst_frame);
+    max_avail_frames   = srcfile_total_frms < dstfile_total_frms ? dstfile_total_frms : srcfile_total_frms;
+    max_avail_frames   = max_avail_frames < qmctx->i_frame_num ? max_avail_frames : qmctx->i_frame_num;
+    fprintf(out_file, "Reference file contain %d frames, Dst file contain %d frames!\n", srcfile_total_frms, dstfile_total_frms);
+
     int pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
-    int pixel_byte = (qmctx->i_bit_depth > 8 ? 2 : 1);
     pixel_max_ssd = pixel_max_value * pixel_max_value;
 
     //// Step 1: Show Title
@@ -179,92 +324,260 @@ int process_quality_metric_singlethread(QMContext* qmctx)
     fprintf(out_file, "\n");
 
     //// Step 2: Metric Quality
-    size_temp = (2 * qmctx->ia_width[CIDX_Y] + 12) * (qmctx->i_bit_depth > 8 ? sizeof(int64_t[4]) : sizeof(int[4]));
+    size_temp = get_metric_temp_size(qmctx) + get_ssim_ref_temp_size(&g_ssim_ref);
     temp = (int *)malloc(size_temp);
     memset(temp, 0, size_temp);
 
+    if (qmctx->i_scale && alloc_scaled_frame(&scaled_frame, &scale_temp) < 0)
+    {
+        fprintf(stderr, "Alloc scaler buffers failed!\n");
+        return -1;
+    }
+    if (qmctx->i_incremental && init_inc_state(&inc, qmctx) < 0)
+    {
+        fprintf(stderr, "Alloc incremental buffers failed!\n");
+        return -1;
+    }
+
+    if (strlen(qmctx->s_affinity) > 0)
+        parse_cpu_list(qmctx->s_affinity, &affinity);
+    if (qmctx->i_stripes > 1 && qmctx->i_stream_rows <= 0)
+    {
+        if (threadpool_init_affinity(&threadp, qmctx->i_threads, strlen(qmctx->s_affinity) > 0 ? &affinity : NULL, 1) < 0)
+            fprintf(stderr, "Starting worker threads failed, --stripes is off!\n");  // threadp NULL: whole planes
+        else
+            init_stripe_context(&sctx, qmctx, threadp);
+    }
+
+    if (qmctx->i_follow && init_follow(&fctx, qmctx) < 0)
+    {
+        fprintf(stderr, "Watch dst yuv file %s error!\n", qmctx->s_dst_fname);
+        return -1;
+    }
+
     fprintf(stderr, "Finished %3d%%", (int)0);
     for (i = 0; i < qmctx->i_frame_num; i++)
     {
-        if (read_nframe(ref_file, &ref_frame, i) < 0)
+        map_frame_pair(qmctx, i, &ref_frm, &dst_frm);
+        if (qmctx->i_follow && follow_wait(&fctx, &dst_src, (dst_frm + 1) * dst_frame.frame_size) < 0)
             break;
-        if (read_nframe(dst_file, &dst_frame, i) < 0)
+        cached = result_cache_get(&g_result_cache, i, frame_ssd, frame_ssim);  // cached pairs are not read
+        if (!cached && qmctx->i_stream_rows > 0)
+        {
+            if (stream_frame_metric(&stctx, qmctx, &ref_src, ref_frm, &dst_src, dst_frm, frame_ssd, frame_ssim) < 0)
+                break;
+        }
+        else if (!cached)
+        {
+            if (source_read_frame(&ref_src, &ref_frame, ref_frm, qmctx->i_planes, READ_WIN(qmctx, ia_ref_win)) < 0)
+                break;
+            if (source_read_frame(&dst_src, &dst_frame, dst_frm, qmctx->i_planes, READ_WIN(qmctx, ia_win)) < 0)
+                break;
+            p_ref = &ref_frame;
+            p_dst = &dst_frame;
+            resample_pair(qmctx, &p_ref, &p_dst, &scaled_frame, scale_temp);
+            if (threadp)
+                stripe_frame_metric(&sctx, p_ref, p_dst, frame_ssd, frame_ssim);
+            else if (qmctx->i_incremental)
+                inc_frame_metric(&inc, qmctx, p_ref, p_dst, frame_ssd, frame_ssim);
+            else
+                ssim_ref_frame_metric(&g_ssim_ref, qmctx, ref_frm, p_ref, p_dst, temp, frame_ssd, frame_ssim);
+        }
+        gate = gate_frame(&g_gate, qmctx, i, frame_ssd, frame_ssim);
+        if (gate == GATE_OPEN && sample_frame(&g_sample_stats, qmctx, frame_ssd, frame_ssim) == SAMPLE_STOP)
+            gate = GATE_DECIDED;  // --ci-stop: this frame is the last one
+        if (gate == GATE_PARTIAL)  // ssd stopped at the --fail-below budget: nothing to store or print
             break;
-        fprintf(out_file, "%6d    ", i + 1);
+        if (!cached)
+            result_cache_put(&g_result_cache, i, frame_ssd, frame_ssim);
+        frame_index_put(&g_frame_index, i, frame_ssd, frame_ssim);
+        fprintf(out_file, "%6d    ", (int)source_pair(qmctx, i) + 1);
         if (qmctx->i_metric_method & M_PSNR)
         {
-            get_frame_ssd(&ref_frame, &dst_frame, frame_ssd);
             for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
             {
-                frame_psnr[cidx] = ssd_to_psnr(pixel_max_ssd * ref_frame.width[cidx] * ref_frame.height[cidx], frame_ssd[cidx]);
+                frame_psnr[cidx] = ssd_to_psnr(pixel_max_ssd * qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3], frame_ssd[cidx]);
                 avg_psnr[cidx] += frame_psnr[cidx];
             }
-            fprintf(out_file, "%6.3f    %6.3f    %6.3f    ", frame_psnr[CIDX_Y], frame_psnr[CIDX_U], frame_psnr[CIDX_V]);
+            sprint_plane_values(values_str, frame_psnr, qmctx->i_planes);
+            fprintf(out_file, "%s", values_str);
         }
         if (qmctx->i_metric_method & M_SSIM)
         {
             for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
-            {
-                if(qmctx->i_bit_depth == 8)
-                    frame_ssim[cidx] = ssim_plane(ref_frame.yuv[cidx], ref_frame.width[cidx],
-                                                  dst_frame.yuv[cidx], dst_frame.width[cidx],
-                                                  ref_frame.width[cidx], ref_frame.height[cidx], temp, pixel_max_value);
-                else if (qmctx->i_bit_depth == 10)
-                    frame_ssim[cidx] = ssim_plane_16bit(ref_frame.yuv[cidx], ref_frame.width[cidx] * pixel_byte,
-                                                        dst_frame.yuv[cidx], dst_frame.width[cidx] * pixel_byte,
-                                                        ref_frame.width[cidx], ref_frame.height[cidx], temp, pixel_max_value);
                 avg_ssim[cidx] += frame_ssim[cidx];
-            }
-            fprintf(out_file, "%6.3f    %6.3f    %6.3f    ", frame_ssim[CIDX_Y], frame_ssim[CIDX_U], frame_ssim[CIDX_V]);
+            sprint_plane_values(values_str, frame_ssim, qmctx->i_planes);
+            fprintf(out_file, "%s", values_str);
         }
         fprintf(out_file, "\n");
         fflush(out_file);
         progress = 100 * (double)i / max_avail_frames;
         fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\bFinished %3d%%", (int)progress);
         fflush(stderr);
+        if (gate == GATE_DECIDED)
+        {
+            i++;
+            break;
+        }
     }
     fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\bFinished %3d%%\n", (int)100);
+    if (i < qmctx->i_frame_num && !gate_decided(&g_gate))  // a read hit the end of an input
+        result_cache_set_end(&g_result_cache, i);
 
     /// Step 3. Show Average result
     qmctx->i_frame_num = i == 0 ? 1 : i;
-    fprintf(out_file, "\nAverage   ");
-    if (qmctx->i_metric_method & M_PSNR)
-        fprintf(out_file, "%6.3f    %6.3f    %6.3f    ", avg_psnr[CIDX_Y] / qmctx->i_frame_num, avg_psnr[CIDX_U] / qmctx->i_frame_num, avg_psnr[CIDX_V] / qmctx->i_frame_num);
-    if (qmctx->i_metric_method & M_SSIM)
-        fprintf(out_file, "%6.3f    %6.3f    %6.3f    ", avg_ssim[CIDX_Y] / qmctx->i_frame_num, avg_ssim[CIDX_U] / qmctx->i_frame_num, avg_ssim[CIDX_V] / qmctx->i_frame_num);
-    fprintf(out_file, "\n");
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        avg_psnr[cidx] /= qmctx->i_frame_num;
+        avg_ssim[cidx] /= qmctx->i_frame_num;
+    }
+    if (i == 0)  // e.g. --fail-below stopped on the first frame
+        fprintf(out_file, "\nAverage   no frame counted\n");
+    else if (gate_cut_short(&g_gate, i))
+        fprintf(out_file, "\nAverage   none, the gate stopped the run early, frames counted: %d\n", i);
+    else
+    {
+        fprintf(out_file, "\nAverage   ");
+        if (qmctx->i_metric_method & M_PSNR)
+        {
+            sprint_plane_values(values_str, avg_psnr, qmctx->i_planes);
+            fprintf(out_file, "%s", values_str);
+        }
+        if (qmctx->i_metric_method & M_SSIM)
+        {
+            sprint_plane_values(values_str, avg_ssim, qmctx->i_planes);
+            fprintf(out_file, "%s", values_str);
+        }
+        fprintf(out_file, "\n");
+    }
 
     /// Step 4. Release resource
-    free_frame(&ref_frame);
-    free_frame(&dst_frame);
+    if (threadp)
+    {
+        threadpool_delete(threadp);
+        free_stripe_context(&sctx);
+    }
+    if (qmctx->i_stream_rows > 0)
+        free_stream_context(&stctx);
+    else
+    {
+        free_frame(&ref_frame);
+        free_frame(&dst_frame);
+    }
+    if (scale_temp)
+    {
+        free_frame(&scaled_frame);
+        free(scale_temp);
+    }
     free(temp);
-    fclose(dst_file);
-    fclose(ref_file);
+    if (qmctx->i_incremental)
+        free_inc_state(&inc);
+    if (qmctx->i_follow)
+        close_follow(&fctx);
+    show_cache_stats(out_file, &g_result_cache);
+    show_ssim_ref_stats(out_file, &g_ssim_ref);
+    show_inc_stats(out_file, &g_inc_stats);
+    show_sample_stats(out_file, &g_sample_stats, qmctx);
+    show_source_stats(out_file, "ref", &ref_src);
+    show_source_stats(out_file, "dst", &dst_src);
+    close_frame_source(&dst_src);
+    close_frame_source(&ref_src);
     return 0;
 }
 
-int init_thread_context(threadCtx* tctx, QMContext* qmctx, threadpool_t* p_pool)
+int alloc_thread_buffers(threadCtx* tctx)
 {
-    tctx->p_pool   = p_pool;
-    tctx->qmctx    = qmctx;
-    tctx->ref_file = fopen(qmctx->s_ref_fname, "rb");
-    if (NULL == tctx->ref_file)
+    QMContext* qmctx = tctx->qmctx;
+    if (qmctx->i_stream_rows > 0)
     {
-        printf("Open ref yuv file %s error!\n", qmctx->s_ref_fname);
+        init_frame_geometry(&tctx->ref_frame, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+        init_frame_geometry(&tctx->dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+        if (init_stream_context(&tctx->stctx, qmctx, qmctx->i_stream_rows) < 0)
+        {
+            printf("Alloc stream buffers failed!\n");
+            return -1;
+        }
+    }
+    else if (qmctx->i_batch > 1)
+    {
+        init_frame_geometry(&tctx->ref_frame, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+        init_frame_geometry(&tctx->dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+        tctx->ref_slab  = (uint8_t *)frame_pool_alloc(&g_frame_pool, (size_t)qmctx->i_batch * tctx->ref_frame.frame_size);
+        tctx->dst_slab  = (uint8_t *)frame_pool_alloc(&g_frame_pool, (size_t)qmctx->i_batch * tctx->dst_frame.frame_size);
+        tctx->batch_str = (char *)malloc(qmctx->i_batch * 128 + 1);
+        if (!tctx->ref_slab || !tctx->dst_slab)
+        {
+            printf("Alloc batch buffers failed!\n");
+            return -1;
+        }
+    }
+    else
+    {
+        alloc_frame(&tctx->ref_frame, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+        alloc_frame(&tctx->dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+    }
+
+    if (qmctx->i_scale && alloc_scaled_frame(&tctx->scaled_frame, &tctx->scale_temp) < 0)
+    {
+        printf("Alloc scaler buffers failed!\n");
         return -1;
     }
-    tctx->dst_file = fopen(qmctx->s_dst_fname, "rb");
-    if (NULL == tctx->ref_file)
+
+    if (qmctx->i_incremental && init_inc_state(&tctx->inc, qmctx) < 0)
     {
-        printf("Open dst yuv file %s error!\n", qmctx->s_dst_fname);
+        printf("Alloc incremental buffers failed!\n");
         return -1;
     }
-    alloc_frame(&tctx->ref_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
-    alloc_frame(&tctx->dst_frame, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
 
-    int size_temp = (2 * qmctx->ia_width[CIDX_Y] + 12) * (qmctx->i_bit_depth > 8 ? sizeof(int64_t[4]) : sizeof(int[4]));
+    int size_temp = get_metric_temp_size(qmctx) + get_ssim_ref_temp_size(&g_ssim_ref);
     tctx->temp = (int *)malloc(size_temp);
     memset(tctx->temp, 0, size_temp);
+    return 0;
+}
+
+/* runs on a worker pinned to the context's numa node, so the first write places the pages on that node */
+void* first_touch_thread_buffers(void* arg)
+{
+    threadCtx* tctx = (threadCtx *)arg;
+    if (alloc_thread_buffers(tctx) < 0)
+        return NULL;
+    if (tctx->qmctx->i_stream_rows > 0)
+    {
+        memset(tctx->stctx.ref_rows, 0, (size_t)tctx->stctx.i_rows * tctx->stctx.ref_geom.width[CIDX_Y] * tctx->stctx.geom.pixel_size);
+        memset(tctx->stctx.dst_rows, 0, (size_t)tctx->stctx.i_rows * tctx->stctx.geom.width[CIDX_Y] * tctx->stctx.geom.pixel_size);
+    }
+    else if (tctx->qmctx->i_batch > 1)
+    {
+        memset(tctx->ref_slab, 0, (size_t)tctx->qmctx->i_batch * tctx->ref_frame.frame_size);
+        memset(tctx->dst_slab, 0, (size_t)tctx->qmctx->i_batch * tctx->dst_frame.frame_size);
+    }
+    else
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        {
+            memset(tctx->ref_frame.yuv[cidx], 0, (size_t)tctx->ref_frame.stride[cidx] * tctx->ref_frame.height[cidx]);
+            memset(tctx->dst_frame.yuv[cidx], 0, (size_t)tctx->dst_frame.stride[cidx] * tctx->dst_frame.height[cidx]);
+        }
+    }
+    if (tctx->scale_temp)
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+            memset(tctx->scaled_frame.yuv[cidx], 0, (size_t)tctx->scaled_frame.stride[cidx] * tctx->scaled_frame.height[cidx]);
+        memset(tctx->scale_temp, 0, get_scaler_temp_size(&g_scaler));
+    }
+    return NULL;
+}
+
+/* defer_alloc: buffers are allocated later by first_touch_thread_buffers on the owning worker */
+int init_thread_context(threadCtx* tctx, QMContext* qmctx, threadpool_t* p_pool, FrameSource* ref_src, FrameSource* dst_src, int defer_alloc)
+{
+    memset(tctx, 0, sizeof(threadCtx));
+    tctx->p_pool   = p_pool;
+    tctx->qmctx    = qmctx;
+    tctx->ref_src  = ref_src;
+    tctx->dst_src  = dst_src;
+    if (!defer_alloc && alloc_thread_buffers(tctx) < 0)
+        return -1;
 
     tctx->i_status = TH_NOTUSED;
     pthread_mutex_init(&tctx->mtx, NULL);
@@ -296,101 +609,374 @@ void release_one_thread_context(threadCtx* tctx)
     tctx->i_status = TH_NOTUSED;
 }
 
-void* process_one_frame(void* arg)
+/* psnr from ssd into tctx->frame_psnr, then the "Frame n: ..." result line appended to output_str */
+void format_frame_result(threadCtx* tctx, int frm_num, int64_t frame_ssd[], char* output_str)
 {
-    threadCtx*      tctx = (threadCtx *)arg;
     QMContext*     qmctx = tctx->qmctx;
     int  pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
-    int  pixel_byte      = (qmctx->i_bit_depth > 8 ? 2 : 1);
     double pixel_max_ssd = pixel_max_value * pixel_max_value;
+
+    output_str += strlen(output_str);
+    sprintf(output_str, "Frame %5d: ", (int)source_pair(qmctx, frm_num) + 1);
+    if (qmctx->i_metric_method & M_PSNR)
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+            tctx->frame_psnr[cidx] = ssd_to_psnr(pixel_max_ssd * qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3], frame_ssd[cidx]);
+        sprint_plane_values(output_str + strlen(output_str), tctx->frame_psnr, qmctx->i_planes);
+    }
+    if (qmctx->i_metric_method & M_SSIM)
+        sprint_plane_values(output_str + strlen(output_str), tctx->frame_ssim, qmctx->i_planes);
+    strcat(output_str, "\n");
+}
+
+void accumulate_frame_result(threadCtx* tctx, double sum_psnr[], double sum_ssim[])
+{
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        sum_psnr[cidx] += tctx->frame_psnr[cidx];
+        sum_ssim[cidx] += tctx->frame_ssim[cidx];
+    }
+}
+
+void* process_one_frame(void* arg)
+{
+    threadCtx*      tctx = (threadCtx *)arg;
+    QMContext*     qmctx = tctx->qmctx;
     int64_t frame_ssd[3];
+    int64_t ref_frm, dst_frm;
+    int     cached, gate, ret = 0;
     char output_str[500];
 
-    if (qmctx->i_exit == 1)
+    // no early out on i_exit: frames queued before the failing one still have to be counted,
+    // frames after it fail their own read
+    map_frame_pair(qmctx, tctx->i_proc_frm_num, &ref_frm, &dst_frm);
+    cached = result_cache_get(&g_result_cache, tctx->i_proc_frm_num, frame_ssd, tctx->frame_ssim);  // cached pairs are not read
+    if (!cached && qmctx->i_stream_rows > 0)
+        ret = stream_frame_metric(&tctx->stctx, qmctx, tctx->ref_src, ref_frm, tctx->dst_src, dst_frm, frame_ssd, tctx->frame_ssim);
+    else if (!cached)
+    {
+        if (source_read_frame(tctx->ref_src, &tctx->ref_frame, ref_frm, qmctx->i_planes, READ_WIN(qmctx, ia_ref_win)) < 0
+            || source_read_frame(tctx->dst_src, &tctx->dst_frame, dst_frm, qmctx->i_planes, READ_WIN(qmctx, ia_win)) < 0)
+            ret = -1;
+        else
+        {
+            Frame* p_ref = &tctx->ref_frame;
+            Frame* p_dst = &tctx->dst_frame;
+            resample_pair(qmctx, &p_ref, &p_dst, &tctx->scaled_frame, tctx->scale_temp);
+            if (qmctx->i_incremental)
+                inc_frame_metric(&tctx->inc, qmctx, p_ref, p_dst, frame_ssd, tctx->frame_ssim);
+            else
+                ssim_ref_frame_metric(&g_ssim_ref, qmctx, ref_frm, p_ref, p_dst, tctx->temp, frame_ssd, tctx->frame_ssim);
+        }
+    }
+    if (ret < 0)
+    {
+        qmctx->i_exit = 1;
+        result_cache_set_end(&g_result_cache, tctx->i_proc_frm_num);
+        release_one_thread_context(tctx);
         return NULL;
+    }
+    gate = gate_frame(&g_gate, qmctx, tctx->i_proc_frm_num, frame_ssd, tctx->frame_ssim);
+    if (gate == GATE_OPEN && sample_frame(&g_sample_stats, qmctx, frame_ssd, tctx->frame_ssim) == SAMPLE_STOP)
+        gate = GATE_DECIDED;
+    if (gate != GATE_OPEN)  // verdict decided: no more frames are dispatched
+        qmctx->i_exit = 1;
+    if (gate == GATE_PARTIAL)
+    {
+        release_one_thread_context(tctx);
+        return NULL;
+    }
+    if (!cached)
+        result_cache_put(&g_result_cache, tctx->i_proc_frm_num, frame_ssd, tctx->frame_ssim);
+    frame_index_put(&g_frame_index, tctx->i_proc_frm_num, frame_ssd, tctx->frame_ssim);
+
+    output_str[0] = 0;
+    format_frame_result(tctx, tctx->i_proc_frm_num, frame_ssd, output_str);
+
+    pthread_mutex_lock(&qmctx->result_stat.mtx);
+    accumulate_frame_result(tctx, qmctx->result_stat.avg_psnr, qmctx->result_stat.avg_ssim);
+    qmctx->result_stat.i_do_frames++;
+    pthread_mutex_unlock(&qmctx->result_stat.mtx);
+
+    release_one_thread_context(tctx);
+    printf("%s", output_str);
+    if (qmctx->i_follow)  // live monitoring: the line goes out as soon as the frame is done
+        fflush(stdout);
+    return NULL;
+}
+
+/* frames i_proc_frm_num .. + i_batch_len - 1: one read per input into the slabs, one stat update, one printf.
+ * with --ref-fps / --dst-fps the mapped frames are not contiguous and are read one by one */
+void* process_frame_batch(void* arg)
+{
+    threadCtx*      tctx = (threadCtx *)arg;
+    QMContext*     qmctx = tctx->qmctx;
+    int        ref_size   = tctx->ref_frame.frame_size;
+    int        dst_size   = tctx->dst_frame.frame_size;
+    int64_t    ref_frames = tctx->ref_src->i64_file_size / ref_size;
+    int64_t    dst_frames = tctx->dst_src->i64_file_size / dst_size;
+    int64_t    ref_first, dst_first, ref_frm, dst_frm;
+    int        frames     = tctx->i_batch_len;
+    int        slab_read  = qmctx->i_planes == PLANES_ALL && qmctx->ia_roi[2] == 0 && qmctx->i_fps_map == FPS_MAP_NONE && !qmctx->ia_sample;
+    double     sum_psnr[3] = { 0.0, 0.0, 0.0 }, sum_ssim[3] = { 0.0, 0.0, 0.0 };
+    int64_t    frame_ssd[3];
+    int        cached, gate;
+    Frame      ref_frame = tctx->ref_frame, dst_frame = tctx->dst_frame;
+    Frame     *p_ref, *p_dst;
 
-    if (read_nframe(tctx->ref_file, &tctx->ref_frame, qmctx->i_ref_skip_num + tctx->i_proc_frm_num) < 0)
+    map_frame_pair(qmctx, tctx->i_proc_frm_num, &ref_first, &dst_first);
+    for (; frames > 0; frames--)  // mapping is monotonic: drop pairs off the end until the last one is in both files
+    {
+        map_frame_pair(qmctx, tctx->i_proc_frm_num + frames - 1, &ref_frm, &dst_frm);
+        if (ref_frm < ref_frames && dst_frm < dst_frames)
+            break;
+    }
+    if (frames < tctx->i_batch_len)
     {
         qmctx->i_exit = 1;
-        return NULL;
+        result_cache_set_end(&g_result_cache, tctx->i_proc_frm_num + frames);
     }
-    if (read_nframe(tctx->dst_file, &tctx->dst_frame, qmctx->i_dst_skip_num + tctx->i_proc_frm_num) < 0)
+    cached = frames > 0 && result_cache_has(&g_result_cache, tctx->i_proc_frm_num, frames);  // then neither input is read
+    if (frames <= 0
+        || (slab_read && !cached && (source_read(tctx->ref_src, ref_first * ref_size, tctx->ref_slab, frames * ref_size) < 0
+                       || source_read(tctx->dst_src, dst_first * dst_size, tctx->dst_slab, frames * dst_size) < 0)))
     {
         qmctx->i_exit = 1;
+        release_one_thread_context(tctx);
         return NULL;
     }
 
-    if (qmctx->i_metric_method & M_PSNR)
+    tctx->batch_str[0] = 0;
+    for (int f = 0; f < frames; f++)
     {
-        get_frame_ssd(&tctx->ref_frame, &tctx->dst_frame, frame_ssd);
-        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        if (cached)
+            result_cache_get(&g_result_cache, tctx->i_proc_frm_num + f, frame_ssd, tctx->frame_ssim);
+        else
         {
-            tctx->frame_psnr[cidx] = ssd_to_psnr(pixel_max_ssd * tctx->ref_frame.width[cidx] * tctx->ref_frame.height[cidx], frame_ssd[cidx]);
-            //avg_psnr[cidx] += frame_psnr[cidx];
+            // frames of the slab are packed exactly as in the file, planes and rows unpadded (stride[] from init_frame_geometry)
+            uint8_t* ref_buf = tctx->ref_slab + (int64_t)f * ref_size;
+            uint8_t* dst_buf = tctx->dst_slab + (int64_t)f * dst_size;
+            ref_frame.yuv[CIDX_Y] = ref_buf;
+            ref_frame.yuv[CIDX_U] = ref_buf + ref_frame.y_size;
+            ref_frame.yuv[CIDX_V] = ref_buf + ref_frame.y_size + ref_frame.uv_size;
+            dst_frame.yuv[CIDX_Y] = dst_buf;
+            dst_frame.yuv[CIDX_U] = dst_buf + dst_frame.y_size;
+            dst_frame.yuv[CIDX_V] = dst_buf + dst_frame.y_size + dst_frame.uv_size;
+            map_frame_pair(qmctx, tctx->i_proc_frm_num + f, &ref_frm, &dst_frm);
+            if (!slab_read  // --planes / --roi / --*-fps / --sample: the selected planes and window rows of the mapped frames, frame by frame
+                && (source_read_frame(tctx->ref_src, &ref_frame, ref_frm, qmctx->i_planes, READ_WIN(qmctx, ia_ref_win)) < 0
+                 || source_read_frame(tctx->dst_src, &dst_frame, dst_frm, qmctx->i_planes, READ_WIN(qmctx, ia_win)) < 0))
+            {
+                qmctx->i_exit = 1;
+                result_cache_set_end(&g_result_cache, tctx->i_proc_frm_num + f);
+                frames = f;
+                break;
+            }
+            p_ref = &ref_frame;
+            p_dst = &dst_frame;
+            resample_pair(qmctx, &p_ref, &p_dst, &tctx->scaled_frame, tctx->scale_temp);
+            if (qmctx->i_incremental)
+                inc_frame_metric(&tctx->inc, qmctx, p_ref, p_dst, frame_ssd, tctx->frame_ssim);
+            else
+                ssim_ref_frame_metric(&g_ssim_ref, qmctx, ref_frm, p_ref, p_dst, tctx->temp, frame_ssd, tctx->frame_ssim);
         }
-        sprintf(output_str, "Frame %5d: %6.3f    %6.3f    %6.3f    ", tctx->i_proc_frm_num + 1, tctx->frame_psnr[CIDX_Y], tctx->frame_psnr[CIDX_U], tctx->frame_psnr[CIDX_V]);
-    }
-    if (qmctx->i_metric_method & M_SSIM)
-    {
-        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        gate = gate_frame(&g_gate, qmctx, tctx->i_proc_frm_num + f, frame_ssd, tctx->frame_ssim);
+        if (gate == GATE_OPEN && sample_frame(&g_sample_stats, qmctx, frame_ssd, tctx->frame_ssim) == SAMPLE_STOP)
+            gate = GATE_DECIDED;
+        if (gate != GATE_OPEN)
+            qmctx->i_exit = 1;
+        if (gate == GATE_PARTIAL)
         {
-            if (qmctx->i_bit_depth == 8)
-                tctx->frame_ssim[cidx] = ssim_plane(tctx->ref_frame.yuv[cidx], tctx->ref_frame.width[cidx],
-                                                    tctx->dst_frame.yuv[cidx], tctx->dst_frame.width[cidx],
-                                                    tctx->ref_frame.width[cidx], tctx->ref_frame.height[cidx], tctx->temp, pixel_max_value);
-            else if (qmctx->i_bit_depth == 10)
-                tctx->frame_ssim[cidx] = ssim_plane_16bit(tctx->ref_frame.yuv[cidx], tctx->ref_frame.width[cidx] * pixel_byte,
-                                                          tctx->dst_frame.yuv[cidx], tctx->dst_frame.width[cidx] * pixel_byte,
-                                                          tctx->ref_frame.width[cidx], tctx->ref_frame.height[cidx], tctx->temp, pixel_max_value);
-            //avg_ssim[cidx] += frame_ssim[cidx];
+            frames = f;
+            break;
+        }
+        if (!cached)
+            result_cache_put(&g_result_cache, tctx->i_proc_frm_num + f, frame_ssd, tctx->frame_ssim);
+        frame_index_put(&g_frame_index, tctx->i_proc_frm_num + f, frame_ssd, tctx->frame_ssim);
+        format_frame_result(tctx, tctx->i_proc_frm_num + f, frame_ssd, tctx->batch_str);
+        accumulate_frame_result(tctx, sum_psnr, sum_ssim);
+        if (gate == GATE_DECIDED)
+        {
+            frames = f + 1;
+            break;
         }
-        sprintf(output_str + strlen(output_str), "%6.3f    %6.3f    %6.3f    ", tctx->frame_ssim[CIDX_Y], tctx->frame_ssim[CIDX_U], tctx->frame_ssim[CIDX_V]);
     }
 
     pthread_mutex_lock(&qmctx->result_stat.mtx);
     for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
     {
-        qmctx->result_stat.avg_psnr[cidx] += tctx->frame_psnr[cidx];
-        qmctx->result_stat.avg_ssim[cidx] += tctx->frame_ssim[cidx];
+        qmctx->result_stat.avg_psnr[cidx] += sum_psnr[cidx];
+        qmctx->result_stat.avg_ssim[cidx] += sum_ssim[cidx];
     }
-    qmctx->result_stat.i_do_frames++;
+    qmctx->result_stat.i_do_frames += frames;
     pthread_mutex_unlock(&qmctx->result_stat.mtx);
 
     release_one_thread_context(tctx);
-    printf("%s\n", output_str);
+    printf("%s", tctx->batch_str);
+    if (qmctx->i_follow)
+        fflush(stdout);
     return NULL;
 }
 
-void process_quality_metric_multithread(QMContext* qmctx)
+/* -1 on error, 0 if no worker thread could be started: nothing is computed or printed, 1 when done */
+int process_quality_metric_multithread(QMContext* qmctx)
 {
     int i_threads  = qmctx->i_threads;
-    int i_tctx_len = i_threads + 4;
-    threadCtx* tctx_arr = (threadCtx *)malloc(i_tctx_len * sizeof(threadCtx));
+    int i_tctx_len = qmctx->i_inflight > 0 ? qmctx->i_inflight : i_threads + 4;
+    int i_nodes    = 1;
+    int i_node_thr, i_node_ctx;
+    int pinned     = strlen(qmctx->s_affinity) > 0;
+    CpuSet  affinity;
+    CpuSet* nodes = (CpuSet *)calloc(MAX_NODES, sizeof(CpuSet));
     threadCtx* tctx = NULL;
-    threadpool_t* threadp;
-    threadpool_init(&threadp, i_threads);
-    for (int i = 0; i < i_tctx_len; i++)
-        init_thread_context(tctx_arr + i, qmctx, threadp);
+    threadpool_t* threadp[MAX_NODES];
+    FrameSource ref_src, dst_src;
+    FollowCtx   fctx;
+    Frame       dst_geom;
+
+    if (nodes == NULL)
+    {
+        printf("Alloc cpu sets failed!\n");
+        return -1;
+    }
+    if (open_frame_source(&ref_src, qmctx->s_ref_fname, qmctx->i_io_chunk) < 0)
+    {
+        printf("Open ref yuv file %s error!\n", qmctx->s_ref_fname);
+        return -1;
+    }
+    if (open_frame_source(&dst_src, qmctx->s_dst_fname, qmctx->i_io_chunk) < 0)
+    {
+        printf("Open dst yuv file %s error!\n", qmctx->s_dst_fname);
+        return -1;
+    }
+    if (qmctx->i_follow && init_follow(&fctx, qmctx) < 0)
+    {
+        printf("Watch dst yuv file %s error!\n", qmctx->s_dst_fname);
+        return -1;
+    }
+    init_frame_geometry(&dst_geom, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+
+    if (strlen(qmctx->s_affinity) > 0)
+        parse_cpu_list(qmctx->s_affinity, &affinity);
+    if (qmctx->i_numa)
+    {
+        i_nodes = get_numa_nodes(nodes, MAX_NODES);
+        for (int n = 0; n < i_nodes && strlen(qmctx->s_affinity) > 0; n++)
+        {
+            intersect_cpu_set(&nodes[n], &affinity);
+            if (nodes[n].i_num == 0)  // no allowed cpu on this node
+            {
+                nodes[n--] = nodes[--i_nodes];
+            }
+        }
+        if (i_nodes == 0)  // no node found or none with an allowed cpu: one group on --affinity, or unpinned
+        {
+            i_nodes = 1;
+            if (pinned)
+                nodes[0] = affinity;
+        }
+        else
+            pinned = 1;
+        i_nodes = i_nodes > i_threads ? i_threads : i_nodes;
+    }
+    else if (pinned)
+        nodes[0] = affinity;
+
+    // every node gets its share of workers and thread contexts and reads only the frames dispatched to it
+    i_node_thr = (i_threads + i_nodes - 1) / i_nodes;
+    i_node_ctx = (i_tctx_len + i_nodes - 1) / i_nodes;
+    i_tctx_len = i_node_ctx * i_nodes;
+    for (int n = 0; n < i_nodes; n++)
+    {
+        if (threadpool_init_affinity(&threadp[n], i_node_thr, pinned ? &nodes[n] : NULL, strlen(qmctx->s_affinity) > 0) < 0)
+        {
+            while (n-- > 0)
+                threadpool_delete(threadp[n]);
+            free(nodes);
+            if (qmctx->i_follow)
+                close_follow(&fctx);
+            close_frame_source(&ref_src);
+            close_frame_source(&dst_src);
+            return 0;
+        }
+    }
+    threadCtx* tctx_arr = (threadCtx *)malloc(i_tctx_len * sizeof(threadCtx));
+    for (int n = 0; n < i_nodes; n++)
+    {
+        for (int i = n * i_node_ctx; i < (n + 1) * i_node_ctx; i++)
+        {
+            init_thread_context(tctx_arr + i, qmctx, threadp[n], &ref_src, &dst_src, i_nodes > 1);
+            if (i_nodes > 1)
+                threadpool_run(threadp[n], first_touch_thread_buffers, tctx_arr + i, 0);
+        }
+    }
+    for (int n = 0; n < i_nodes; n++)
+        threadpool_sync(threadp[n]);
 
-    for (int i = 0; i < qmctx->i_frame_num; i++)
+    int i_batch = qmctx->i_stream_rows > 0 ? 1 : qmctx->i_batch;
+    for (int i = 0; i < qmctx->i_frame_num; i += i_batch)
     {
         if (qmctx->i_exit == 0)
         {
-            tctx = get_one_thread_context(tctx_arr, i_tctx_len);
+            int n   = (i / i_batch) % i_nodes;
+            int len = qmctx->i_frame_num - i < i_batch ? qmctx->i_frame_num - i : i_batch;
+            if (qmctx->i_follow)  // dispatch once the last dst frame of the job is written
+            {
+                int64_t ref_frm, dst_frm;
+                map_frame_pair(qmctx, i + len - 1, &ref_frm, &dst_frm);
+                if (follow_wait(&fctx, &dst_src, (dst_frm + 1) * dst_geom.frame_size) < 0)
+                    break;
+            }
+            tctx = get_one_thread_context(tctx_arr + n * i_node_ctx, i_node_ctx);
             tctx->i_proc_frm_num = i;
-            threadpool_run(threadp, process_one_frame, tctx, 0);
+            tctx->i_batch_len    = len;
+            threadpool_run(threadp[n], i_batch > 1 ? process_frame_batch : process_one_frame, tctx, 0);
         }
     }
-    threadpool_delete(threadp);
+    for (int n = 0; n < i_nodes; n++)
+        threadpool_delete(threadp[n]);
+    free(nodes);
+    if (qmctx->i_follow)
+        close_follow(&fctx);
+    show_cache_stats(stdout, &g_result_cache);
+    show_ssim_ref_stats(stdout, &g_ssim_ref);
+    show_inc_stats(stdout, &g_inc_stats);
+    show_sample_stats(stdout, &g_sample_stats, qmctx);
+    show_source_stats(stdout, "ref", &ref_src);
+    show_source_stats(stdout, "dst", &dst_src);
+    close_frame_source(&ref_src);
+    close_frame_source(&dst_src);
 
     StatResult* res = &qmctx->result_stat;
-    res->i_do_frames == 0 ? 1 : res->i_do_frames;
+    char values_str[64];
+    if (res->i_do_frames == 0)  // e.g. --fail-below stopped on the first frame
+    {
+        printf("\nAverage   no frame counted\n");
+        return 1;
+    }
+    if (gate_cut_short(&g_gate, res->i_do_frames))
+    {
+        printf("\nAverage   none, the gate stopped the run early, frames counted: %d\n", res->i_do_frames);
+        return 1;
+    }
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        res->avg_psnr[cidx] /= res->i_do_frames;
+        res->avg_ssim[cidx] /= res->i_do_frames;
+    }
     printf("\nAverage   ");
     if (qmctx->i_metric_method & M_PSNR)
-        printf("%6.3f    %6.3f    %6.3f    ", res->avg_psnr[CIDX_Y] / res->i_do_frames, res->avg_psnr[CIDX_U] / res->i_do_frames, res->avg_psnr[CIDX_V] / res->i_do_frames);
+    {
+        sprint_plane_values(values_str, res->avg_psnr, qmctx->i_planes);
+        printf("%s", values_str);
+    }
     if (qmctx->i_metric_method & M_SSIM)
-        printf("%6.3f    %6.3f    %6.3f    ", res->avg_ssim[CIDX_Y] / res->i_do_frames, res->avg_ssim[CIDX_U] / res->i_do_frames, res->avg_ssim[CIDX_V] / res->i_do_frames);
+    {
+        sprint_plane_values(values_str, res->avg_ssim, qmctx->i_planes);
+        printf("%s", values_str);
+    }
     printf("\n");
+    return 1;
 }
 
 int main(int argc, char* argv[])
@@ -400,9 +986,64 @@ int main(int argc, char* argv[])
         showHelp();
         return 0;
     }
+    if (!strcmp(argv[1], "query"))
+        return query_frame_index(argc - 2, argv + 2);
     QMContext qmctx;
+    Frame     geom, ref_geom;
+    int       ret;
     get_default_qmctx(&qmctx);
     parse_cmds(argc, argv, &qmctx);
+    if (qmctx.i_planes == 0)
+    {
+        fprintf(stderr, "Invalid --planes, use a combination of y, u and v!\n");
+        return -1;
+    }
+    if (qmctx.i_scale < 0)
+    {
+        fprintf(stderr, "Invalid --scale, use bilinear, bicubic or lanczos!\n");
+        return -1;
+    }
+    if (qmctx.ia_roi[2] < 0)
+    {
+        fprintf(stderr, "Invalid --roi, use x,y,w,h or auto!\n");
+        return -1;
+    }
+    if (qmctx.i64_max_memory < 0 || qmctx.i_io_chunk < 0)
+    {
+        fprintf(stderr, "Invalid --max-memory / --io-chunk, use a positive size, e.g. 4096 (MB), 512M, 1.5G, 800K or 65536B!\n");
+        return -1;
+    }
+    if (qmctx.ia_ref_fps[0] < 0 || qmctx.ia_dst_fps[0] < 0 || qmctx.i_fps_map < 0)
+    {
+        fprintf(stderr, "Invalid --ref-fps / --dst-fps / --fps-map, use e.g. 60, 29.97 or 30000/1001 and nearest, drop or repeat!\n");
+        return -1;
+    }
+    if (qmctx.f_fail_psnr < 0 || qmctx.f_avg_psnr < 0)
+    {
+        fprintf(stderr, "Invalid --fail-below / --avg-target, use e.g. psnr:35, ssim:0.95 or psnr:35,ssim:0.95!\n");
+        return -1;
+    }
+    if (qmctx.i_sample < 0 || qmctx.f_ci_stop < 0)
+    {
+        fprintf(stderr, "Invalid --sample / --ci-stop, use every:K, random:N[:SEED] or list:FILE and a positive tolerance!\n");
+        return -1;
+    }
+    if (qmctx.i_follow && (qmctx.i_sample || qmctx.f_ci_stop > 0))
+    {
+        fprintf(stderr, "--sample and --ci-stop need the frames of dst up front, they cannot be used with --follow!\n");
+        return -1;
+    }
+    if (((qmctx.f_fail_psnr > 0 || qmctx.f_avg_psnr > 0) && !(qmctx.i_metric_method & M_PSNR))
+        || ((qmctx.f_fail_ssim > 0 || qmctx.f_avg_ssim > 0) && !(qmctx.i_metric_method & M_SSIM)))
+    {
+        fprintf(stderr, "A psnr / ssim gate needs that metric in --metric-method!\n");
+        return -1;
+    }
+    if (qmctx.ia_ref_fps[0] == 0 || qmctx.ia_dst_fps[0] == 0
+        || (int64_t)qmctx.ia_ref_fps[0] * qmctx.ia_dst_fps[1] == (int64_t)qmctx.ia_dst_fps[0] * qmctx.ia_ref_fps[1])
+        qmctx.i_fps_map = FPS_MAP_NONE;  // same rate: frame i against frame i
+    else if (qmctx.i_fps_map == FPS_MAP_NONE)
+        qmctx.i_fps_map = FPS_MAP_NEAREST;
 
     if (strlen(qmctx.s_out_fname) > 0)
     {
@@ -414,13 +1055,217 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (qmctx.i_threads <= 0)  // --threads auto
+        qmctx.i_threads = get_available_cpus();
+    qmctx.i_threads = qmctx.i_threads > MAX_THREADS ? MAX_THREADS : qmctx.i_threads;
+
+    if (qmctx.i_ref_bit_depth <= 0)
+        qmctx.i_ref_bit_depth = qmctx.i_bit_depth;
+    if (qmctx.i_dst_bit_depth <= 0)
+        qmctx.i_dst_bit_depth = qmctx.i_bit_depth;
+    if (qmctx.i_ref_chroma_format < 0)
+        qmctx.i_ref_chroma_format = qmctx.i_chroma_format;
+    if (qmctx.i_dst_chroma_format < 0)
+        qmctx.i_dst_chroma_format = qmctx.i_chroma_format;
+    qmctx.i_convert       = qmctx.i_ref_bit_depth != qmctx.i_dst_bit_depth || qmctx.i_ref_chroma_format != qmctx.i_dst_chroma_format;
+    qmctx.i_bit_depth     = qmctx.i_ref_bit_depth < qmctx.i_dst_bit_depth ? qmctx.i_ref_bit_depth : qmctx.i_dst_bit_depth;
+    qmctx.i_chroma_format = qmctx.i_ref_chroma_format < qmctx.i_dst_chroma_format ? qmctx.i_ref_chroma_format : qmctx.i_dst_chroma_format;  // 420 < 422 < 444
+    if (qmctx.i_convert && qmctx.i_scale)
+    {
+        fprintf(stderr, "--scale needs both inputs in the same chroma format and bit depth!\n");
+        return -1;
+    }
+    if (qmctx.i_bitexact && (qmctx.i_convert || qmctx.i_scale))
+    {
+        fprintf(stderr, "--bitexact needs both inputs in the same format and geometry, it cannot be used with --scale!\n");
+        return -1;
+    }
+    if (qmctx.i_align > 0 && qmctx.i_scale)
+    {
+        fprintf(stderr, "--align needs both inputs at the same resolution, it cannot be used with --scale!\n");
+        return -1;
+    }
+    if (qmctx.i_ref_width <= 0)
+        qmctx.i_ref_width = qmctx.ia_width[CIDX_Y];
+    if (qmctx.i_ref_height <= 0)
+        qmctx.i_ref_height = qmctx.ia_height[CIDX_Y];
+
+    if (qmctx.i_batch <= 0)  // --batch auto
+        qmctx.i_batch = get_auto_batch_size(&qmctx);
+    if (qmctx.i_batch > get_max_batch_size(&qmctx))
+    {
+        fprintf(stderr, "--batch %d is reduced to %d, a job reads at most %d MB per input!\n", qmctx.i_batch,
+                get_max_batch_size(&qmctx), MAX_BATCH_BYTES >> 20);
+        qmctx.i_batch = get_max_batch_size(&qmctx);
+    }
+    if ((qmctx.i_sample || qmctx.f_ci_stop > 0) && build_sample_table(&qmctx) < 0)
+    {
+        fprintf(stderr, "No frame to sample, or read --sample list %s error!\n", qmctx.s_sample_list);
+        return -1;
+    }
+
     show_parameters(&qmctx);
+    frame_pool_init(&g_frame_pool, qmctx.i_hugepages);
 
-    if (qmctx.i_threads > 1)
-        process_quality_metric_multithread(&qmctx);
-    else
+    if (qmctx.i_align > 0)
+    {
+        if (detect_alignment(&qmctx, qmctx.i_align, qmctx.ia_ref_offset) < 0)
+        {
+            fprintf(stderr, "Alignment search on %s / %s failed!\n", qmctx.s_ref_fname, qmctx.s_dst_fname);
+            return -1;
+        }
+        fprintf(qmctx.out_file, "align: ref offset %d,%d\n", qmctx.ia_ref_offset[0], qmctx.ia_ref_offset[1]);
+    }
+    if (qmctx.i_roi_auto && detect_letterbox(&qmctx, qmctx.ia_roi) < 0)
+    {
+        fprintf(stderr, "Letterbox detection on %s failed!\n", qmctx.s_ref_fname);
+        return -1;
+    }
+    // compare-format geometry of both sides
+    init_frame_geometry(&geom, qmctx.ia_width[CIDX_Y], qmctx.ia_height[CIDX_Y], qmctx.i_bit_depth, qmctx.i_chroma_format);
+    init_frame_geometry(&ref_geom, qmctx.i_ref_width, qmctx.i_ref_height, qmctx.i_bit_depth, qmctx.i_chroma_format);
+    if (qmctx.i_scale)
+    {
+        // the pair is compared at the geometry of the side that is not resampled
+        int to_ref = qmctx.i_scale_target == SCALE_TO_REF;
+        if (init_scaler(&g_scaler, qmctx.i_scale, to_ref ? &geom : &ref_geom, to_ref ? &ref_geom : &geom) < 0)
+        {
+            fprintf(stderr, "Init scaler failed!\n");
+            return -1;
+        }
+        if (to_ref)
+            geom = ref_geom;
+        else
+            ref_geom = geom;
+    }
+    if (init_plane_windows(&qmctx, &ref_geom, &geom) < 0)
+    {
+        fprintf(stderr, "Compared window is smaller than %dx%d or --ref-offset is off the chroma grid!\n", ROI_MIN_SIZE, ROI_MIN_SIZE);
+        return -1;
+    }
+    if (qmctx.ia_roi[2] > 0)
+        fprintf(qmctx.out_file, "roi: %d,%d %dx%d\n", qmctx.ia_roi[0], qmctx.ia_roi[1], qmctx.ia_roi[2], qmctx.ia_roi[3]);
+
+    if (qmctx.i_bitexact)
+    {
+        ret = run_bitexact(&qmctx);
+        frame_pool_destroy(&g_frame_pool);
+        fclose(qmctx.out_file);
+        return ret;
+    }
+
+    if (qmctx.i64_max_memory > 0)
+    {
+        MemPlan plan;
+        if (plan_memory(&qmctx, &plan) < 0)
+        {
+            fprintf(stderr, "Memory budget %lld bytes is too small for %dx%d frames!\n", (long long)qmctx.i64_max_memory,
+                    qmctx.ia_width[CIDX_Y], qmctx.ia_height[CIDX_Y]);
+            return -1;
+        }
+        qmctx.i_inflight    = plan.i_inflight;
+        qmctx.i_stripes     = plan.i_stripes;
+        qmctx.i_stream_rows = plan.i_stream_rows;
+        qmctx.i_batch       = plan.i_batch;
+        show_memory_plan(&qmctx, &plan);
+    }
+
+    if (qmctx.i_scale && qmctx.i_stream_rows > 0)
+    {
+        fprintf(stderr, "--stream-rows is ignored with --scale, frames are resampled whole!\n");
+        qmctx.i_stream_rows = 0;
+    }
+    if (qmctx.i_convert && (qmctx.i_stream_rows > 0 || qmctx.i_stripes > 1))
+    {
+        fprintf(stderr, "--stream-rows and --stripes are ignored when the input formats differ!\n");
+        qmctx.i_stream_rows = 0;
+        qmctx.i_stripes     = 1;
+    }
+
+    if (strlen(qmctx.s_cache_dir) > 0)
+    {
+        if (qmctx.i_follow)
+            fprintf(stderr, "--cache is ignored with --follow, dst is still changing!\n");
+        else if (qmctx.ia_sample)
+            fprintf(stderr, "--cache is ignored with --sample / --ci-stop!\n");
+        else if (open_result_cache(&g_result_cache, &qmctx, VER_MAJOR << 24 | VER_MINOR << 16 | VER_RELEASE << 8 | VER_BUILD) < 0)
+            fprintf(stderr, "Fingerprinting the inputs failed, --cache is off!\n");
+        else if (g_result_cache.i_end >= 0 && g_result_cache.i_end < qmctx.i_frame_num)
+            qmctx.i_frame_num = g_result_cache.i_end;  // pairs in the inputs known: no read has to run into the end
+    }
+
+    if (qmctx.i_incremental && qmctx.i_convert)
+    {
+        fprintf(stderr, "--incremental is ignored when the input formats differ!\n");
+        qmctx.i_incremental = 0;
+    }
+    if (qmctx.i_incremental)
+    {
+        if (qmctx.i_stream_rows > 0 || qmctx.i_stripes > 1)
+        {
+            fprintf(stderr, "--stream-rows and --stripes are ignored with --incremental, bands are kept per frame!\n");
+            qmctx.i_stream_rows = 0;
+            qmctx.i_stripes     = 1;
+        }
+        if (strlen(qmctx.s_ssim_ref_fname) > 0)
+        {
+            fprintf(stderr, "--ssim-ref is ignored with --incremental!\n");
+            qmctx.s_ssim_ref_fname[0] = 0;
+        }
+        init_inc_stats(&g_inc_stats);
+    }
+    if (strlen(qmctx.s_ssim_ref_fname) > 0)
+    {
+        if (!(qmctx.i_metric_method & M_SSIM) || qmctx.i_convert || qmctx.i_bit_depth > SSIMREF_MAX_BIT_DEPTH)
+            fprintf(stderr, "--ssim-ref is ignored without ssim, with differing input formats or above %d bits!\n", SSIMREF_MAX_BIT_DEPTH);
+        else
+        {
+            if (qmctx.i_stream_rows > 0 || qmctx.i_stripes > 1)
+            {
+                fprintf(stderr, "--stream-rows and --stripes are ignored with --ssim-ref, the sums are per frame!\n");
+                qmctx.i_stream_rows = 0;
+                qmctx.i_stripes     = 1;
+            }
+            if (open_ssim_ref(&g_ssim_ref, &qmctx) < 0)
+            {
+                fprintf(stderr, "Open ssim ref sidecar %s error!\n", qmctx.s_ssim_ref_fname);
+                return -1;
+            }
+        }
+    }
+
+    if (qmctx.f_fail_psnr > 0 || qmctx.f_fail_ssim > 0 || qmctx.f_avg_psnr > 0 || qmctx.f_avg_ssim > 0)
+        init_gate(&g_gate, &qmctx);
+    if (qmctx.ia_sample)
+    {
+        if (strlen(qmctx.s_index_fname) > 0)
+        {
+            fprintf(stderr, "--index is ignored with --sample / --ci-stop!\n");
+            qmctx.s_index_fname[0] = 0;
+        }
+        init_sample_stats(&g_sample_stats, &qmctx);
+    }
+    init_frame_index(&g_frame_index, &qmctx);
+    if (qmctx.i_stripes > 1)  // final once the plan and the options that turn it off are through
+        fprintf(qmctx.out_file, "stripes: %d\n", qmctx.i_stripes);
+
+    if (qmctx.i_threads > 1 && qmctx.i_stripes <= 1 && process_quality_metric_multithread(&qmctx) == 0)
+    {
+        fprintf(stderr, "Starting worker threads failed, running single-threaded!\n");
+        qmctx.i_threads = 1;
+    }
+    if (qmctx.i_threads <= 1 || qmctx.i_stripes > 1)
         process_quality_metric_singlethread(&qmctx);
+    close_result_cache(&g_result_cache);
+    close_ssim_ref(&g_ssim_ref);
+    if (write_frame_index(&g_frame_index, &qmctx) < 0)
+        fprintf(stderr, "Write index %s error!\n", qmctx.s_index_fname);
 
+    if (qmctx.i_scale)
+        free_scaler(&g_scaler);
+    ret = g_gate.i_enabled ? gate_verdict(&g_gate, &qmctx, qmctx.out_file) : 1;
+    free_sample_table(&qmctx);
+    frame_pool_destroy(&g_frame_pool);
     fclose(qmctx.out_file);
-    return 1;
+    return ret;
 }
\ No newline at end of file
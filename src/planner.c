@@ -0,0 +1,190 @@
+/**
+ * ===========================================================================
+ * planner.c
+ * - memory budgeted execution planner
+ * ===========================================================================
+ */
+#include "planner.h"
+#include "stripe.h"
+#include "framesource.h"
+#include "scaler.h"
+#include <string.h>
+
+static const char* plan_name[3] = { "frame", "stripe", "stream" };
+
+/* "512", "512M", "1.5G", "800K", "65536B"; plain numbers are MB. -1 if invalid or not positive */
+int64_t parse_mem_size(const char* str)
+{
+    char*  end  = NULL;
+    double val  = strtod(str, &end);
+    double unit = 1 << 20;
+
+    if (end == str)
+        return -1;
+    switch (*end)
+    {
+    case 'b': case 'B': unit = 1;       end++; break;
+    case 'k': case 'K': unit = 1 << 10; end++; break;
+    case 'm': case 'M':                 end++; break;
+    case 'g': case 'G': unit = 1 << 30; end++; break;
+    }
+    val *= unit;
+    if (*end || !(val >= 1 && val < 9e18))  // trailing garbage, <= 0, nan or past int64_t
+        return -1;
+    return (int64_t)val;
+}
+
+/* bytes of one ref + dst frame, and of one luma row of each in row_pair; the geometries may differ */
+static int64_t get_pair_size(QMContext* qmctx, int64_t* row_pair)
+{
+    Frame g, rg;
+
+    init_frame_geometry(&g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+    init_frame_geometry(&rg, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    *row_pair = (int64_t)g.width[CIDX_Y] * g.pixel_size + (int64_t)rg.width[CIDX_Y] * rg.pixel_size;
+    if (qmctx->i_scale)  // resampled copy of one side plus the scaler's intermediate rows
+        return (int64_t)g.frame_size + rg.frame_size + g_scaler.dst_geom.frame_size + get_scaler_temp_size(&g_scaler);
+    return (int64_t)g.frame_size + rg.frame_size;
+}
+
+int64_t estimate_plan_memory(QMContext* qmctx, MemPlan* plan)
+{
+    Frame   g;
+    int64_t temp, pair, row_pair;
+
+    init_frame_geometry(&g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
+    temp = get_ssim_temp_size(g.width[CIDX_Y], g.bit_depth);
+    pair = get_pair_size(qmctx, &row_pair);
+
+    switch (plan->i_mode)
+    {
+    case PLAN_STRIPE:
+        return pair + temp + 3 * (int64_t)plan->i_stripes * temp
+             + 3 * (int64_t)(g.height[CIDX_Y] / 4 + 1) * sizeof(float);
+    case PLAN_STREAM:
+        return plan->i_inflight * ((int64_t)plan->i_stream_rows * row_pair + temp);
+    default:
+        return plan->i_inflight * (pair * plan->i_batch + temp);
+    }
+}
+
+/* rows per stream stripe that fit `bytes` for one context, multiple of 4, 0 if not even 4 rows fit */
+static int fit_stream_rows(QMContext* qmctx, int64_t bytes)
+{
+    Frame   g;
+    int64_t row_bytes, rows;
+
+    init_frame_geometry(&g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
+    get_pair_size(qmctx, &row_bytes);
+    rows = (bytes - get_ssim_temp_size(g.width[CIDX_Y], g.bit_depth)) / row_bytes;
+    rows &= ~3;
+    if (rows > g.height[CIDX_Y])
+        rows = (g.height[CIDX_Y] + 3) & ~3;
+    return rows < 4 ? 0 : (int)rows;
+}
+
+/* Fill plan from the current options; if i64_max_memory is set and the options do not fit, re-plan.
+ * Preference: whole frames with all threads busy, then one pair split in bands, then streaming. */
+int plan_memory(QMContext* qmctx, MemPlan* plan)
+{
+    int64_t budget  = qmctx->i64_max_memory;
+    int     threads = qmctx->i_threads;
+
+    memset(plan, 0, sizeof(MemPlan));
+    if (budget > 0 && (budget -= 2 * IO_RING_SLOTS * (int64_t)qmctx->i_io_chunk) <= 0)  // --io-chunk staging rings come first
+        return -1;
+
+    plan->i_inflight    = threads > 1 ? (qmctx->i_inflight > 0 ? qmctx->i_inflight : threads + 4) : 1;
+    plan->i_stripes     = qmctx->i_stripes;
+    plan->i_stream_rows = qmctx->i_stream_rows;
+    plan->i_batch       = qmctx->i_batch;
+    if (qmctx->i_stream_rows > 0)
+        plan->i_mode = PLAN_STREAM;
+    else if (qmctx->i_stripes > 1)
+    {
+        plan->i_mode     = PLAN_STRIPE;
+        plan->i_inflight = 1;
+    }
+    else
+        plan->i_mode = PLAN_FRAME;
+    plan->i64_bytes = estimate_plan_memory(qmctx, plan);
+    if (budget <= 0 || plan->i64_bytes <= budget)
+        return 0;
+
+    // 1. fewer whole-frame contexts, as long as every worker still has a pair
+    plan->i_batch       = 1;
+    plan->i_mode        = PLAN_FRAME;
+    plan->i_stream_rows = 0;
+    plan->i_stripes     = 1;
+    plan->i_inflight    = 1;
+    int64_t per_pair = estimate_plan_memory(qmctx, plan);
+    if (budget / per_pair >= threads)
+    {
+        int64_t n = budget / per_pair;
+        plan->i_inflight = (int)(n < threads + 4 ? n : threads + 4);
+        plan->i64_bytes  = estimate_plan_memory(qmctx, plan);
+        return 0;
+    }
+
+    // 2. one pair in flight, planes split into bands over all workers (same-format inputs only)
+    if (threads > 1 && !qmctx->i_convert)
+    {
+        plan->i_mode    = PLAN_STRIPE;
+        plan->i_stripes = threads < MAX_STRIPES ? threads : MAX_STRIPES;
+        for (; plan->i_stripes > 1; plan->i_stripes--)
+        {
+            plan->i64_bytes = estimate_plan_memory(qmctx, plan);
+            if (plan->i64_bytes <= budget)
+                return 0;
+        }
+        plan->i_stripes = 1;
+    }
+
+    // 3. stream row stripes: keep every worker busy, then grow the stripe height. not with --scale or
+    //    differing formats, the resampler and the converter work on whole frames
+    if (qmctx->i_scale || qmctx->i_convert)
+        return -1;
+    plan->i_mode     = PLAN_STREAM;
+    plan->i_inflight = threads > 1 ? threads : 1;
+    for (; plan->i_inflight >= 1; plan->i_inflight--)
+    {
+        plan->i_stream_rows = fit_stream_rows(qmctx, budget / plan->i_inflight);
+        if (plan->i_stream_rows > 0)
+        {
+            plan->i64_bytes = estimate_plan_memory(qmctx, plan);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void show_memory_plan(QMContext* qmctx, MemPlan* plan)
+{
+    fprintf(qmctx->out_file, "memory plan: mode %s, in-flight pairs %d, batch %d, stripes %d, stream rows %d, buffers %.1f MB of %.1f MB\n\n",
+            plan_name[plan->i_mode], plan->i_inflight, plan->i_batch, plan->i_stripes, plan->i_stream_rows,
+            plan->i64_bytes / 1048576.0, qmctx->i64_max_memory / 1048576.0);
+}
+
+/* largest --batch whose slab read stays within MAX_BATCH_BYTES for both inputs, at least 1 */
+int get_max_batch_size(QMContext* qmctx)
+{
+    Frame ref_g, dst_g;
+    int   size, batch;
+
+    init_frame_geometry(&ref_g, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    init_frame_geometry(&dst_g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+    size  = ref_g.frame_size > dst_g.frame_size ? ref_g.frame_size : dst_g.frame_size;
+    batch = MAX_BATCH_BYTES / size;
+    return batch < 1 ? 1 : (batch > MAX_BATCH ? MAX_BATCH : batch);
+}
+
+/* --batch auto: enough consecutive frames for a ~2 MB read per input, 1 for frames of 1 MB and up */
+int get_auto_batch_size(QMContext* qmctx)
+{
+    Frame g;
+    int   batch;
+
+    init_frame_geometry(&g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_bit_depth, qmctx->i_chroma_format);
+    batch = (2 << 20) / g.frame_size;
+    return batch < 1 ? 1 : (batch > MAX_BATCH ? MAX_BATCH : batch);
+}
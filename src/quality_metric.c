@@ -1,4 +1,5 @@
 #include "quality_metric.h"
+#include "convert.h"
 #include <math.h>
 #include <string.h>
 #ifdef linux
@@ -24,6 +25,53 @@ void get_default_qmctx(QMContext* qmctx)
     qmctx->i_ref_skip_num    = qmctx->i_dst_skip_num    = 0;
     qmctx->i_auto_skip       = 0;
     qmctx->i_threads         = 1;
+    qmctx->i_stripes         = 1;
+    qmctx->i_stream_rows     = 0;
+    qmctx->i_inflight        = 0;
+    qmctx->i64_max_memory    = 0;
+    qmctx->i_hugepages       = 0;
+    qmctx->i_numa            = 0;
+    qmctx->i_io_chunk        = 0;
+    qmctx->i_planes          = PLANES_ALL;
+    qmctx->i_roi_auto        = 0;
+    memset(qmctx->ia_roi, 0, sizeof(qmctx->ia_roi));
+    memset(qmctx->ia_win, 0, sizeof(qmctx->ia_win));
+    qmctx->i_ref_width       = 0;
+    qmctx->i_ref_height      = 0;
+    memset(qmctx->ia_ref_offset, 0, sizeof(qmctx->ia_ref_offset));
+    memset(qmctx->ia_ref_win, 0, sizeof(qmctx->ia_ref_win));
+    qmctx->i_align           = 0;
+    qmctx->i_scale           = 0;
+    qmctx->i_scale_target    = 0;
+    qmctx->i_ref_bit_depth   = 0;
+    qmctx->i_ref_chroma_format = -1;
+    qmctx->i_dst_bit_depth   = 0;
+    qmctx->i_dst_chroma_format = -1;
+    qmctx->i_convert         = 0;
+    qmctx->ia_ref_fps[0]     = qmctx->ia_dst_fps[0]     = 0;
+    qmctx->ia_ref_fps[1]     = qmctx->ia_dst_fps[1]     = 1;
+    qmctx->i_fps_map         = 0;
+    qmctx->i_batch           = 1;
+    qmctx->i_follow          = 0;
+    qmctx->i_follow_pid      = 0;
+    qmctx->s_follow_sentinel[0] = 0;
+    qmctx->s_cache_dir[0] = 0;
+    qmctx->s_index_fname[0] = 0;
+    qmctx->s_ssim_ref_fname[0] = 0;
+    qmctx->i_incremental     = 0;
+    qmctx->i_bitexact        = 0;
+    qmctx->i_sample          = 0;
+    qmctx->i_sample_arg      = 0;
+    qmctx->i_sample_seed     = 0;
+    qmctx->s_sample_list[0]  = 0;
+    qmctx->ia_sample         = NULL;
+    qmctx->i_sample_num      = 0;
+    qmctx->i_sample_pairs    = 0;
+    qmctx->f_ci_stop         = 0;
+    qmctx->f_fail_psnr       = qmctx->f_fail_ssim = 0;
+    qmctx->f_avg_psnr        = qmctx->f_avg_ssim  = 0;
+    memset(qmctx->i64_ssd_budget, 0, sizeof(qmctx->i64_ssd_budget));
+    qmctx->s_affinity[0] = 0;
     qmctx->i_metric_method   = M_PSNR;
     qmctx->i_exit            = 0;
     qmctx->out_file          = stdout;
@@ -31,7 +79,31 @@ void get_default_qmctx(QMContext* qmctx)
     pthread_mutex_init(&qmctx->result_stat.mtx, NULL);
 }
 
+/* bytes of the sum0 / sum1 scratch buffer ssim_plane needs for a plane of this width */
+int get_ssim_temp_size(int width, int bit_depth)
+{
+    return (2 * width + 12) * (bit_depth > 8 ? sizeof(int64_t[4]) : sizeof(int[4]));
+}
+
+/* temp buffer get_frame_metric needs: ssim scratch for the wider input, plus converted rows with differing formats */
+int get_metric_temp_size(QMContext* qmctx)
+{
+    int width = qmctx->ia_width[CIDX_Y] > qmctx->i_ref_width ? qmctx->ia_width[CIDX_Y] : qmctx->i_ref_width;
+    return get_ssim_temp_size(width, qmctx->i_bit_depth) + (qmctx->i_convert ? get_convert_temp_size(width) : 0);
+}
+
 int64_t get_block_ssd_8bit(unsigned char* pix1, unsigned char* pix2, int width, int height)
+{
+    return get_block_ssd_8bit_stride(pix1, width, pix2, width, width, height);
+}
+
+int64_t get_block_ssd_10bit(uint16_t* pix1, uint16_t* pix2, int width, int height)
+{
+    return get_block_ssd_10bit_stride(pix1, width, pix2, width, width, height);
+}
+
+/* stride1 / stride2 in pixels */
+int64_t get_block_ssd_8bit_stride(unsigned char* pix1, int stride1, unsigned char* pix2, int stride2, int width, int height)
 {
     int64_t sum = 0, ssd;
     int x, y, tmp;
@@ -42,14 +114,14 @@ int64_t get_block_ssd_8bit(unsigned char* pix1, unsigned char* pix2, int width,
             tmp = pix1[x] - pix2[x];
             sum += (tmp * tmp);
         }
-        pix1 += width;
-        pix2 += width;
+        pix1 += stride1;
+        pix2 += stride2;
     }
     ssd = sum;
     return ssd;
 }
 
-int64_t get_block_ssd_10bit(uint16_t* pix1, uint16_t* pix2, int width, int height)
+int64_t get_block_ssd_10bit_stride(uint16_t* pix1, int stride1, uint16_t* pix2, int stride2, int width, int height)
 {
     int64_t sum = 0, ssd;
     int x, y, tmp;
@@ -60,29 +132,13 @@ int64_t get_block_ssd_10bit(uint16_t* pix1, uint16_t* pix2, int width, int heigh
             tmp = pix1[x] - pix2[x];
             sum += (tmp * tmp);
         }
-        pix1 += width;
-        pix2 += width;
+        pix1 += stride1;
+        pix2 += stride2;
     }
     ssd = sum;
     return ssd;
 }
 
-void get_frame_ssd(Frame* ref, Frame* dst, int64_t ssd[])
-{
-    if (ref->pixel_size == 1) // 8-bit
-    {
-        ssd[CIDX_Y] = get_block_ssd_8bit(ref->yuv[CIDX_Y], dst->yuv[CIDX_Y], ref->width[CIDX_Y], ref->height[CIDX_Y]);
-        ssd[CIDX_U] = get_block_ssd_8bit(ref->yuv[CIDX_U], dst->yuv[CIDX_U], ref->width[CIDX_U], ref->height[CIDX_U]);
-        ssd[CIDX_V] = get_block_ssd_8bit(ref->yuv[CIDX_V], dst->yuv[CIDX_V], ref->width[CIDX_V], ref->height[CIDX_V]);
-    }
-    else if (ref->pixel_size == 2) // 10-bit
-    {
-        ssd[CIDX_Y] = get_block_ssd_10bit((uint16_t*)ref->yuv[CIDX_Y], (uint16_t*)dst->yuv[CIDX_Y], ref->width[CIDX_Y], ref->height[CIDX_Y]);
-        ssd[CIDX_U] = get_block_ssd_10bit((uint16_t*)ref->yuv[CIDX_U], (uint16_t*)dst->yuv[CIDX_U], ref->width[CIDX_U], ref->height[CIDX_U]);
-        ssd[CIDX_V] = get_block_ssd_10bit((uint16_t*)ref->yuv[CIDX_V], (uint16_t*)dst->yuv[CIDX_V], ref->width[CIDX_V], ref->height[CIDX_V]);
-    }
-}
-
 int jump_to_frame(FILE* in_f, int64_t frame_size, int64_t frame_number)
 {
     int ret = 0;
@@ -113,6 +169,21 @@ int jump_to_frame(FILE* in_f, int64_t frame_size, int64_t frame_number)
 }
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+/* ssd of the window in SSD_BUDGET_ROWS row steps, stops as soon as it exceeds budget. stride1 / stride2 in pixels */
+int64_t get_plane_ssd_budget(uint8_t* pix1, int stride1, uint8_t* pix2, int stride2, int width, int height, int pixel_size, int64_t budget)
+{
+    int64_t ssd = 0;
+    for (int y = 0; y < height && ssd <= budget; y += SSD_BUDGET_ROWS)
+    {
+        int rows = height - y < SSD_BUDGET_ROWS ? height - y : SSD_BUDGET_ROWS;
+        if (pixel_size == 1)
+            ssd += get_block_ssd_8bit_stride(pix1 + (int64_t)y * stride1, stride1, pix2 + (int64_t)y * stride2, stride2, width, rows);
+        else
+            ssd += get_block_ssd_10bit_stride((uint16_t*)pix1 + (int64_t)y * stride1, stride1, (uint16_t*)pix2 + (int64_t)y * stride2, stride2, width, rows);
+    }
+    return ssd;
+}
+
 double ssd_to_psnr(double max_ssd, int64_t act_ssd)
 {
     double max_psnr = 99.9999;
@@ -125,6 +196,39 @@ double ssd_to_psnr(double max_ssd, int64_t act_ssd)
         return max_psnr;
 }
 
+/* "y", "uv", "yuv", ...: plane mask for --planes, 0 if str names no valid plane */
+int parse_planes(const char* str)
+{
+    int planes = 0;
+    for (; *str; str++)
+    {
+        switch (*str)
+        {
+        case 'y': case 'Y': planes |= 1 << CIDX_Y; break;
+        case 'u': case 'U': planes |= 1 << CIDX_U; break;
+        case 'v': case 'V': planes |= 1 << CIDX_V; break;
+        default:            return 0;
+        }
+    }
+    return planes;
+}
+
+const char* plane_name[3] = { "Y", "U", "V" };
+
+/* one result column per plane, "-" for planes that were not computed */
+int sprint_plane_values(char* str, double val[], int planes)
+{
+    int len = 0;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        if (planes & (1 << cidx))
+            len += sprintf(str + len, "%6.3f    ", val[cidx]);
+        else
+            len += sprintf(str + len, "     -    ");
+    }
+    return len;
+}
+
 /* Following functions refer to ffmpeg */
 static void ssim_4x4xn(const uint8_t *main, ptrdiff_t main_stride,
                        const uint8_t *ref, ptrdiff_t ref_stride,
@@ -187,6 +291,8 @@ static float ssim_endn(const int(*sum0)[4], const int(*sum1)[4], int width)
 }
 
 #define FFSWAP(type,a,b) do{type SWAP_tmp= b; b= a; a= SWAP_tmp;}while(0)
+typedef int     ssim_sums_t[4];     // block sums of one 4x4 block, 8-bit / 16-bit kernels
+typedef int64_t ssim_sums16_t[4];
 
 static void ssim_4x4xn_16bit(const uint8_t *main8, ptrdiff_t main_stride,
                              const uint8_t *ref8, ptrdiff_t ref_stride,
@@ -308,4 +414,373 @@ float ssim_plane_16bit(uint8_t *main, int main_stride,
     }
 
     return ssim / ((height - 1) * (width - 1));
-}
\ No newline at end of file
+}
+/* 1 if the height rows of row_bytes of both windows are byte-identical, strides in bytes.
+ * memcmp stops at the first difference, so differing planes cost about one row */
+int plane_identical(uint8_t *p_ref, int ref_stride, uint8_t *p_dst, int dst_stride, int row_bytes, int height)
+{
+    for (int y = 0; y < height; y++)
+        if (memcmp(p_ref + (int64_t)y * ref_stride, p_dst + (int64_t)y * dst_stride, row_bytes))
+            return 0;
+    return 1;
+}
+
+/* one block row of ssim_plane: the sums of the width / 4 blocks of 4 rows into sums, int[4] or int64_t[4] by pixel_size */
+void ssim_block_row(uint8_t *main, int main_stride, uint8_t *ref, int ref_stride,
+                    void *sums, int width, int pixel_size)
+{
+    if (pixel_size == 1)
+        ssim_4x4xn(main, main_stride, ref, ref_stride, (int(*)[4])sums, width >> 2);
+    else
+        ssim_4x4xn_16bit(main, main_stride, ref, ref_stride, (int64_t(*)[4])sums, width >> 2);
+}
+
+/* the value ssim_plane adds for the row whose lower block row has the sums sum0 and upper block row sum1 */
+float ssim_block_row_end(const void *sum0, const void *sum1, int width, int pixel_size, int max)
+{
+    if (pixel_size == 1)
+        return ssim_endn((const int(*)[4])sum0, (const int(*)[4])sum1, (width >> 2) - 1);
+    return ssim_endn_16bit((const int64_t(*)[4])sum0, (const int64_t(*)[4])sum1, (width >> 2) - 1, max);
+}
+
+/* ssim_plane with the reference half of the block sums precomputed (--ssim-ref): main is the reference,
+ * sq / sum hold its sum of squares and sum for every 4x4 block of the plane, block row after block row.
+ * only the dst and cross terms are accumulated, the result is bit-exact with ssim_plane */
+static void ssim_4x4xn_refstats(const uint8_t *main, ptrdiff_t main_stride,
+                                const uint8_t *ref, ptrdiff_t ref_stride,
+                                const uint32_t *sq, const uint16_t *sum,
+                                int(*sums)[4], int width)
+{
+    int x, y, z;
+
+    for (z = 0; z < width; z++) {
+        uint32_t s2 = 0, ss = 0, s12 = 0;
+
+        for (y = 0; y < 4; y++) {
+            for (x = 0; x < 4; x++) {
+                int a = main[x + y * main_stride];
+                int b = ref[x + y * ref_stride];
+
+                s2 += b;
+                ss += b*b;
+                s12 += a*b;
+            }
+        }
+
+        sums[z][0] = sum[z];
+        sums[z][1] = s2;
+        sums[z][2] = sq[z] + ss;
+        sums[z][3] = s12;
+        main += 4;
+        ref += 4;
+    }
+}
+
+static void ssim_4x4xn_refstats_16bit(const uint8_t *main8, ptrdiff_t main_stride,
+                                      const uint8_t *ref8, ptrdiff_t ref_stride,
+                                      const uint32_t *sq, const uint16_t *sum,
+                                      int64_t(*sums)[4], int width)
+{
+    const uint16_t *main16 = (const uint16_t *)main8;
+    const uint16_t *ref16 = (const uint16_t *)ref8;
+    int x, y, z;
+
+    main_stride >>= 1;
+    ref_stride >>= 1;
+
+    for (z = 0; z < width; z++) {
+        uint64_t s2 = 0, ss = 0, s12 = 0;
+
+        for (y = 0; y < 4; y++) {
+            for (x = 0; x < 4; x++) {
+                unsigned a = main16[x + y * main_stride];
+                unsigned b = ref16[x + y * ref_stride];
+
+                s2 += b;
+                ss += b*b;
+                s12 += a*b;
+            }
+        }
+
+        sums[z][0] = sum[z];
+        sums[z][1] = s2;
+        sums[z][2] = sq[z] + ss;
+        sums[z][3] = s12;
+        main16 += 4;
+        ref16 += 4;
+    }
+}
+
+float ssim_plane_refstats(uint8_t *main, int main_stride,
+                          uint8_t *ref,  int ref_stride,
+                          int width, int height, void *temp, int max,
+                          const uint32_t *sq, const uint16_t *sum)
+{
+    int z = 0, y;
+    float ssim = 0.0;
+    int(*sum0)[4] = (int(*)[4])temp;
+    int(*sum1)[4] = sum0 + (width >> 2) + 3;
+
+    (void)max;  // same signature as the 16-bit version
+    width >>= 2;
+    height >>= 2;
+
+    for (y = 1; y < height; y++)
+    {
+        for (; z <= y; z++)
+        {
+            FFSWAP(ssim_sums_t*, sum0, sum1);
+            ssim_4x4xn_refstats(&main[4 * z * main_stride], main_stride,
+                                &ref[4 * z * ref_stride],   ref_stride,
+                                sq + z * width, sum + z * width, sum0, width);
+        }
+
+        ssim += ssim_endn((const int(*)[4])sum0, (const int(*)[4])sum1, width - 1);
+    }
+
+    return ssim / ((height - 1) * (width - 1));
+}
+
+float ssim_plane_refstats_16bit(uint8_t *main, int main_stride,
+                                uint8_t *ref,  int ref_stride,
+                                int width, int height, void *temp, int max,
+                                const uint32_t *sq, const uint16_t *sum)
+{
+    int z = 0, y;
+    float ssim = 0.0;
+    int64_t(*sum0)[4] = (int64_t(*)[4])temp;
+    int64_t(*sum1)[4] = sum0 + (width >> 2) + 3;
+
+    width >>= 2;
+    height >>= 2;
+
+    for (y = 1; y < height; y++) {
+        for (; z <= y; z++) {
+            FFSWAP(ssim_sums16_t*, sum0, sum1);
+            ssim_4x4xn_refstats_16bit(&main[4 * z * main_stride], main_stride,
+                                      &ref[4 * z * ref_stride],   ref_stride,
+                                      sq + z * width, sum + z * width, sum0, width);
+        }
+
+        ssim += ssim_endn_16bit((const int64_t(*)[4])sum0, (const int64_t(*)[4])sum1, width - 1, max);
+    }
+
+    return ssim / ((height - 1) * (width - 1));
+}
+
+/* sum of squares and sum of every 4x4 block of a width x height plane window, stride in bytes */
+void ssim_ref_block_stats(uint8_t *ref, int stride, int width, int height, int pixel_size,
+                          uint32_t *sq, uint16_t *sum)
+{
+    width >>= 2;
+    height >>= 2;
+
+    for (int z = 0; z < height; z++)
+    {
+        for (int b = 0; b < width; b++)
+        {
+            uint32_t s = 0, ss = 0;
+            for (int y = 0; y < 4; y++)
+            {
+                uint8_t* row = ref + (int64_t)(4 * z + y) * stride + 4 * b * pixel_size;
+                for (int x = 0; x < 4; x++)
+                {
+                    unsigned a = pixel_size == 1 ? row[x] : ((uint16_t *)row)[x];
+                    s  += a;
+                    ss += a*a;
+                }
+            }
+            *sq++  = ss;
+            *sum++ = (uint16_t)s;
+        }
+    }
+}
+
+/* Band version of ssim_plane: evaluates the ssim rows y_begin..y_end-1 (in 4x4 block rows,
+ * 1 <= y_begin < y_end <= height / 4) and stores each row's sum in row_ssim[y].
+ * Row y needs block rows y-1 and y, so a band starts one block row above its first output row.
+ * Summing row_ssim[1..] in order gives exactly the value ssim_plane accumulates. */
+void ssim_plane_band(uint8_t *main, int main_stride,
+                     uint8_t *ref,  int ref_stride,
+                     int width, int y_begin, int y_end,
+                     void *temp, float *row_ssim)
+{
+    int z = y_begin - 1, y;
+    int(*sum0)[4] = (int(*)[4])temp;
+    int(*sum1)[4] = sum0 + (width >> 2) + 3;
+
+    width >>= 2;
+
+    for (y = y_begin; y < y_end; y++)
+    {
+        for (; z <= y; z++)
+        {
+            FFSWAP(ssim_sums_t*, sum0, sum1);
+            ssim_4x4xn(&main[4 * z * main_stride], main_stride,
+                       &ref[4 * z * ref_stride],   ref_stride,
+                       sum0, width);
+        }
+
+        row_ssim[y] = ssim_endn((const int(*)[4])sum0, (const int(*)[4])sum1, width - 1);
+    }
+}
+
+void ssim_plane_band_16bit(uint8_t *main, int main_stride,
+                           uint8_t *ref,  int ref_stride,
+                           int width, int y_begin, int y_end,
+                           void *temp, float *row_ssim, int max)
+{
+    int z = y_begin - 1, y;
+    int64_t(*sum0)[4] = (int64_t(*)[4])temp;
+    int64_t(*sum1)[4] = sum0 + (width >> 2) + 3;
+
+    width >>= 2;
+
+    for (y = y_begin; y < y_end; y++) {
+        for (; z <= y; z++) {
+            FFSWAP(ssim_sums16_t*, sum0, sum1);
+            ssim_4x4xn_16bit(&main[4 * z * main_stride], main_stride,
+                             &ref[4 * z * ref_stride],   ref_stride,
+                             sum0, width);
+        }
+
+        row_ssim[y] = ssim_endn_16bit((const int64_t(*)[4])sum0, (const int64_t(*)[4])sum1, width - 1, max);
+    }
+}
+
+/* Reduce the per-row values of ssim_plane_band in the same order as ssim_plane */
+float ssim_rows_to_plane(const float *row_ssim, int width, int height)
+{
+    float ssim = 0.0;
+    int y;
+
+    width >>= 2;
+    height >>= 2;
+    for (y = 1; y < height; y++)
+        ssim += row_ssim[y];
+    return ssim / ((height - 1) * (width - 1));
+}
+
+/* Incremental ssim: block rows are pushed top to bottom and accumulated in the same order
+ * as ssim_plane, so only the two rolling sum rows of the plane have to stay in memory. */
+void ssim_stream_init(SsimStream* ss, void* temp, int width, int pixel_size, int max)
+{
+    ss->i_width    = width;
+    ss->i_16bit    = pixel_size > 1;
+    ss->i_max      = max;
+    ss->i_blk_rows = 0;
+    ss->ssim       = 0.0;
+    ss->sum0       = temp;
+    if (ss->i_16bit)
+        ss->sum1 = (int64_t(*)[4])temp + (width >> 2) + 3;
+    else
+        ss->sum1 = (int(*)[4])temp + (width >> 2) + 3;
+}
+
+/* main_stride ref_stride is stride in bytes, blk_rows block rows (4 pixel rows each) are consumed */
+void ssim_stream_push(SsimStream* ss, uint8_t *main, int main_stride,
+                      uint8_t *ref, int ref_stride, int blk_rows)
+{
+    int width = ss->i_width >> 2;
+
+    for (int z = 0; z < blk_rows; z++)
+    {
+        FFSWAP(void*, ss->sum0, ss->sum1);
+        if (ss->i_16bit)
+        {
+            ssim_4x4xn_16bit(&main[4 * z * main_stride], main_stride,
+                             &ref[4 * z * ref_stride],   ref_stride,
+                             (int64_t(*)[4])ss->sum0, width);
+            if (ss->i_blk_rows > 0)
+                ss->ssim += ssim_endn_16bit((const int64_t(*)[4])ss->sum0, (const int64_t(*)[4])ss->sum1, width - 1, ss->i_max);
+        }
+        else
+        {
+            ssim_4x4xn(&main[4 * z * main_stride], main_stride,
+                       &ref[4 * z * ref_stride],   ref_stride,
+                       (int(*)[4])ss->sum0, width);
+            if (ss->i_blk_rows > 0)
+                ss->ssim += ssim_endn((const int(*)[4])ss->sum0, (const int(*)[4])ss->sum1, width - 1);
+        }
+        ss->i_blk_rows++;
+    }
+}
+
+float ssim_stream_end(SsimStream* ss)
+{
+    return ss->ssim / ((ss->i_blk_rows - 1) * ((ss->i_width >> 2) - 1));
+}
+
+/* metrics of every selected plane between the ia_ref_win window of ref and the ia_win window of dst;
+ * the two frames may have different geometries, every kernel gets its own stride per frame */
+void get_frame_metric(QMContext* qmctx, Frame* ref, Frame* dst, void* temp, int64_t ssd[], double ssim[])
+{
+    get_frame_metric_refstats(qmctx, ref, dst, temp, NULL, ssd, ssim);
+}
+
+/* get_frame_metric with the ssim block sums of ref taken from stats where it has them (--ssim-ref) */
+void get_frame_metric_refstats(QMContext* qmctx, Frame* ref, Frame* dst, void* temp, const SsimRefStats* stats,
+                               int64_t ssd[], double ssim[])
+{
+    int pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+
+    if (qmctx->i_convert)
+    {
+        convert_frame_metric(qmctx, ref, dst, temp, ssd, ssim);
+        return;
+    }
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int*  win        = qmctx->ia_win[cidx];
+        int*  ref_win    = qmctx->ia_ref_win[cidx];
+        int   ref_stride = ref->stride[cidx];
+        int   dst_stride = dst->stride[cidx];
+        uint8_t* p_ref   = ref->yuv[cidx] + (int64_t)ref_win[1] * ref_stride + ref_win[0] * ref->pixel_size;
+        uint8_t* p_dst   = dst->yuv[cidx] + (int64_t)win[1] * dst_stride + win[0] * dst->pixel_size;
+
+        ssd[cidx]  = 0;
+        ssim[cidx] = 0;
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        if (plane_identical(p_ref, ref_stride, p_dst, dst_stride, win[2] * ref->pixel_size, win[3]))
+        {
+            // identical block sums give ssim_end1 exactly 1, so the kernels would return exactly 1 and ssd 0
+            if (qmctx->i_metric_method & M_SSIM)
+                ssim[cidx] = 1.0;
+            continue;
+        }
+        if ((qmctx->i_metric_method & M_PSNR) && qmctx->i64_ssd_budget[cidx] > 0)
+        {
+            // --fail-below: once over the budget the frame fails whatever the other rows hold, the other metrics are not needed
+            ssd[cidx] = get_plane_ssd_budget(p_ref, ref_stride / ref->pixel_size, p_dst, dst_stride / dst->pixel_size, win[2], win[3],
+                                             ref->pixel_size, qmctx->i64_ssd_budget[cidx]);
+            if (ssd[cidx] > qmctx->i64_ssd_budget[cidx])
+            {
+                for (int c = cidx + 1; c <= CIDX_V; c++)
+                    ssd[c] = 0, ssim[c] = 0;
+                return;
+            }
+        }
+        else if (qmctx->i_metric_method & M_PSNR)
+        {
+            if (ref->pixel_size == 1)
+                ssd[cidx] = get_block_ssd_8bit_stride(p_ref, ref_stride / ref->pixel_size, p_dst, dst_stride / dst->pixel_size, win[2], win[3]);
+            else
+                ssd[cidx] = get_block_ssd_10bit_stride((uint16_t*)p_ref, ref_stride / ref->pixel_size, (uint16_t*)p_dst, dst_stride / dst->pixel_size, win[2], win[3]);
+        }
+        if (qmctx->i_metric_method & M_SSIM)
+        {
+            if (stats && stats->sq[cidx] && ref->pixel_size == 1)
+                ssim[cidx] = ssim_plane_refstats(p_ref, ref_stride, p_dst, dst_stride, win[2], win[3], temp, pixel_max_value,
+                                                 stats->sq[cidx], stats->sum[cidx]);
+            else if (stats && stats->sq[cidx])
+                ssim[cidx] = ssim_plane_refstats_16bit(p_ref, ref_stride, p_dst, dst_stride, win[2], win[3], temp, pixel_max_value,
+                                                       stats->sq[cidx], stats->sum[cidx]);
+            else if (ref->pixel_size == 1)
+                ssim[cidx] = ssim_plane(p_ref, ref_stride, p_dst, dst_stride, win[2], win[3], temp, pixel_max_value);
+            else
+                ssim[cidx] = ssim_plane_16bit(p_ref, ref_stride, p_dst, dst_stride, win[2], win[3], temp, pixel_max_value);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+/**
+ * ===========================================================================
+ * roi.c
+ * - crop window of --roi and letterbox detection, common window of ref and
+ *   dst frames of different geometry
+ * ===========================================================================
+ */
+#include "roi.h"
+#include "framesource.h"
+#include <string.h>
+
+/* "x,y,w,h" in luma pixels, 0 on success */
+int parse_roi(const char* str, int roi[4])
+{
+    if (sscanf(str, "%d,%d,%d,%d", &roi[0], &roi[1], &roi[2], &roi[3]) != 4)
+        return -1;
+    return roi[0] < 0 || roi[1] < 0 || roi[2] <= 0 || roi[3] <= 0 ? -1 : 0;
+}
+
+static int is_bar_line(uint8_t* p, int step, int count, int pixel_size, int black)
+{
+    for (int i = 0; i < count; i++, p += step)
+    {
+        int v = pixel_size == 1 ? *p : *(uint16_t *)p;
+        if (v > black)
+            return 0;
+    }
+    return 1;
+}
+
+/* Bars on the four sides of the ref luma plane in up to LB_SAMPLES frames spread over the compared range;
+ * a side keeps the thinnest bar seen so dark scenes do not eat into the picture.
+ * roi gets the active picture in dst coordinates, the whole frame if there are no bars. */
+int detect_letterbox(QMContext* qmctx, int roi[4])
+{
+    FrameSource src;
+    Frame   f;
+    int     width  = qmctx->i_ref_width;
+    int     height = qmctx->i_ref_height;
+    int     bar[4] = { height, height, width, width };  // top, bottom, left, right
+    int     black, stride, avail, samples = 0;
+
+    if (open_frame_source(&src, qmctx->s_ref_fname, 0) < 0)
+        return -1;
+    if (alloc_frame(&f, width, height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format) < 0)
+    {
+        close_frame_source(&src);
+        return -1;
+    }
+    black  = LB_BLACK_LEVEL << (qmctx->i_ref_bit_depth - 8);
+    stride = f.stride[CIDX_Y];
+    avail  = source_frame_num(&src, &f) - qmctx->i_ref_skip_num;
+    avail  = avail < qmctx->i_frame_num ? avail : qmctx->i_frame_num;
+
+    for (int s = 0; s < LB_SAMPLES && s < avail; s++)
+    {
+        int64_t frm = qmctx->i_ref_skip_num + (int64_t)avail * s / LB_SAMPLES;
+        uint8_t* y  = f.yuv[CIDX_Y];
+        int top = 0, bottom = 0, left = 0, right = 0;
+
+        if (source_read_frame(&src, &f, frm, 1 << CIDX_Y, NULL) < 0)
+            break;
+        while (top < height && is_bar_line(y + (int64_t)top * stride, f.pixel_size, width, f.pixel_size, black))
+            top++;
+        if (top == height)  // black frame, says nothing about the bars
+            continue;
+        while (is_bar_line(y + (int64_t)(height - 1 - bottom) * stride, f.pixel_size, width, f.pixel_size, black))
+            bottom++;
+        y += (int64_t)top * stride;
+        while (is_bar_line(y + left * f.pixel_size, stride, height - top - bottom, f.pixel_size, black))
+            left++;
+        while (is_bar_line(y + (width - 1 - right) * f.pixel_size, stride, height - top - bottom, f.pixel_size, black))
+            right++;
+
+        bar[0] = top    < bar[0] ? top    : bar[0];
+        bar[1] = bottom < bar[1] ? bottom : bar[1];
+        bar[2] = left   < bar[2] ? left   : bar[2];
+        bar[3] = right  < bar[3] ? right  : bar[3];
+        samples++;
+    }
+    free_frame(&f);
+    close_frame_source(&src);
+
+    if (samples == 0)
+        memset(bar, 0, sizeof(bar));
+    roi[0] = bar[2] - qmctx->ia_ref_offset[0];  // dst coordinates
+    roi[1] = bar[0] - qmctx->ia_ref_offset[1];
+    roi[2] = width  - bar[2] - bar[3];
+    roi[3] = height - bar[0] - bar[1];
+    return 0;
+}
+
+/* Clamp ia_roi to the part of the dst frame that also exists in ref (ia_ref_offset apart), snap it to the
+ * chroma grid and derive the window of every plane in dst (ia_win) and ref (ia_ref_win) coordinates.
+ * No roi: the window is that common part, the whole frame when both geometries agree.
+ * -1 if the window is smaller than ROI_MIN_SIZE. */
+int init_plane_windows(QMContext* qmctx, Frame* ref_geom, Frame* geom)
+{
+    int  rect[4];
+    int* off = qmctx->ia_ref_offset;
+    int  sx  = geom->width[CIDX_Y] / geom->width[CIDX_U];
+    int  sy  = geom->height[CIDX_Y] / geom->height[CIDX_U];
+    int  x0  = off[0] < 0 ? -off[0] : 0;
+    int  y0  = off[1] < 0 ? -off[1] : 0;
+    int  x1  = ref_geom->width[CIDX_Y] - off[0] < geom->width[CIDX_Y]  ? ref_geom->width[CIDX_Y] - off[0]  : geom->width[CIDX_Y];
+    int  y1  = ref_geom->height[CIDX_Y] - off[1] < geom->height[CIDX_Y] ? ref_geom->height[CIDX_Y] - off[1] : geom->height[CIDX_Y];
+
+    if (qmctx->ia_roi[2] <= 0 && !off[0] && !off[1]
+        && ref_geom->width[CIDX_Y] == geom->width[CIDX_Y] && ref_geom->height[CIDX_Y] == geom->height[CIDX_Y])
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        {
+            qmctx->ia_win[cidx][0] = qmctx->ia_ref_win[cidx][0] = 0;
+            qmctx->ia_win[cidx][1] = qmctx->ia_ref_win[cidx][1] = 0;
+            qmctx->ia_win[cidx][2] = qmctx->ia_ref_win[cidx][2] = geom->width[cidx];
+            qmctx->ia_win[cidx][3] = qmctx->ia_ref_win[cidx][3] = geom->height[cidx];
+        }
+        return 0;
+    }
+    if (off[0] % sx || off[1] % sy)
+        return -1;
+    if (qmctx->ia_roi[2] > 0)
+    {
+        x0 = qmctx->ia_roi[0] > x0 ? qmctx->ia_roi[0] : x0;
+        y0 = qmctx->ia_roi[1] > y0 ? qmctx->ia_roi[1] : y0;
+        x1 = qmctx->ia_roi[0] + qmctx->ia_roi[2] < x1 ? qmctx->ia_roi[0] + qmctx->ia_roi[2] : x1;
+        y1 = qmctx->ia_roi[1] + qmctx->ia_roi[3] < y1 ? qmctx->ia_roi[1] + qmctx->ia_roi[3] : y1;
+    }
+    // inner chroma-aligned rectangle: round the origin up and the far edge down
+    rect[0] = (x0 + sx - 1) / sx * sx;
+    rect[1] = (y0 + sy - 1) / sy * sy;
+    rect[2] = x1 / sx * sx - rect[0];
+    rect[3] = y1 / sy * sy - rect[1];
+    if (rect[2] < ROI_MIN_SIZE || rect[3] < ROI_MIN_SIZE)
+        return -1;
+    if (qmctx->ia_roi[2] > 0)
+        memcpy(qmctx->ia_roi, rect, sizeof(rect));
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int csx = cidx == CIDX_Y ? 1 : sx;
+        int csy = cidx == CIDX_Y ? 1 : sy;
+        qmctx->ia_win[cidx][0] = rect[0] / csx;
+        qmctx->ia_win[cidx][1] = rect[1] / csy;
+        qmctx->ia_win[cidx][2] = rect[2] / csx;
+        qmctx->ia_win[cidx][3] = rect[3] / csy;
+        qmctx->ia_ref_win[cidx][0] = (rect[0] + off[0]) / csx;
+        qmctx->ia_ref_win[cidx][1] = (rect[1] + off[1]) / csy;
+        qmctx->ia_ref_win[cidx][2] = rect[2] / csx;
+        qmctx->ia_ref_win[cidx][3] = rect[3] / csy;
+    }
+    return 0;
+}
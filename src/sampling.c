@@ -0,0 +1,221 @@
+/**
+ * ===========================================================================
+ * sampling.c
+ * - the sample is a table of pairs of the full run, map_frame_pair goes
+ *   through it, so every reader seeks straight to the sampled frames by
+ *   offset and the frames in between are never read
+ * - random sampling is stratified: the pairs are cut into N equal runs and
+ *   one pair is drawn from each, the draws are deterministic for a seed
+ * - with --ci-stop the table is shuffled, so the frames counted at any
+ *   point are an unbiased subsample; the interval of the mean is
+ *   z * s / sqrt(n) with the finite population correction for the pairs
+ *   of the full run
+ * ===========================================================================
+ */
+#include "sampling.h"
+#include "framemap.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+SampleStats g_sample_stats;
+
+/* "every:4", "random:100", "random:100:7" or "list:frames.txt". -1 if invalid */
+int parse_sample(const char* str, QMContext* qmctx)
+{
+    int n = 0, m = 0;
+
+    if (sscanf(str, "every:%d%n", &qmctx->i_sample_arg, &n) == 1 && !str[n] && qmctx->i_sample_arg > 0)
+        qmctx->i_sample = SAMPLE_EVERY;
+    else if (sscanf(str, "random:%d%n", &qmctx->i_sample_arg, &n) == 1 && qmctx->i_sample_arg > 0
+             && (!str[n] || (sscanf(str + n, ":%u%n", &qmctx->i_sample_seed, &m) == 1 && !str[n + m])))
+        qmctx->i_sample = SAMPLE_RANDOM;
+    else if (!strncmp(str, "list:", 5) && strlen(str) > 5)
+    {
+        sprintf(qmctx->s_sample_list, "%s", str + 5);
+        qmctx->i_sample = SAMPLE_LIST;
+    }
+    else
+        return -1;
+    return 0;
+}
+
+/* splitmix64 */
+static uint64_t next_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int compare_int(const void* a, const void* b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* 1-based frame numbers separated by white space or commas, the ones within pairs are kept sorted and unique */
+static int read_sample_list(QMContext* qmctx, int pairs)
+{
+    FILE* f = fopen(qmctx->s_sample_list, "r");
+    int   size = 256, num = 0, frame;
+
+    if (f == NULL)
+        return -1;
+    qmctx->ia_sample = (int *)malloc(size * sizeof(int));
+    while (qmctx->ia_sample && fscanf(f, "%d", &frame) == 1)
+    {
+        fscanf(f, " ,");
+        if (frame < 1 || frame > pairs)
+            continue;
+        if (num == size)
+        {
+            size *= 2;
+            qmctx->ia_sample = (int *)realloc(qmctx->ia_sample, size * sizeof(int));
+            if (qmctx->ia_sample == NULL)
+                break;
+        }
+        qmctx->ia_sample[num++] = frame - 1;
+    }
+    fclose(f);
+    if (qmctx->ia_sample == NULL)
+        return -1;
+    qsort(qmctx->ia_sample, num, sizeof(int), compare_int);
+    qmctx->i_sample_num = 0;
+    for (int i = 0; i < num; i++)
+        if (i == 0 || qmctx->ia_sample[i] != qmctx->ia_sample[i - 1])
+            qmctx->ia_sample[qmctx->i_sample_num++] = qmctx->ia_sample[i];
+    return 0;
+}
+
+/* ia_sample from the pairs of the full run; i_frame_num becomes the sample size. -1 on error or an empty sample */
+int build_sample_table(QMContext* qmctx)
+{
+    int      pairs = count_frame_pairs(qmctx);
+    uint64_t state = qmctx->i_sample_seed;
+
+    qmctx->i_sample_pairs = pairs;  // count_frame_pairs gives the sample size once ia_sample is set
+
+    if (qmctx->i_sample == SAMPLE_NONE)  // --ci-stop alone: every pair, in random order
+    {
+        qmctx->i_sample     = SAMPLE_EVERY;
+        qmctx->i_sample_arg = 1;
+    }
+    if (qmctx->i_sample == SAMPLE_LIST)
+    {
+        if (read_sample_list(qmctx, pairs) < 0)
+            return -1;
+    }
+    else
+    {
+        int num = qmctx->i_sample == SAMPLE_EVERY ? (pairs + qmctx->i_sample_arg - 1) / qmctx->i_sample_arg
+                                                  : (qmctx->i_sample_arg < pairs ? qmctx->i_sample_arg : pairs);
+        qmctx->ia_sample = (int *)malloc((num > 0 ? num : 1) * sizeof(int));
+        if (qmctx->ia_sample == NULL)
+            return -1;
+        for (int i = 0; i < num; i++)
+        {
+            if (qmctx->i_sample == SAMPLE_EVERY)
+                qmctx->ia_sample[i] = i * qmctx->i_sample_arg;
+            else  // stratum i is pairs [i * pairs / num, (i + 1) * pairs / num)
+            {
+                int lo = (int)((int64_t)i * pairs / num);
+                int hi = (int)((int64_t)(i + 1) * pairs / num);
+                qmctx->ia_sample[i] = lo + (int)(next_random(&state) % (hi - lo));
+            }
+        }
+        qmctx->i_sample_num = num;
+    }
+    if (qmctx->i_sample_num == 0)
+        return -1;
+    if (qmctx->f_ci_stop > 0)  // fisher-yates: any prefix of the table is a random subsample
+    {
+        for (int i = qmctx->i_sample_num - 1; i > 0; i--)
+        {
+            int j = (int)(next_random(&state) % (i + 1));
+            int t = qmctx->ia_sample[i];
+            qmctx->ia_sample[i] = qmctx->ia_sample[j];
+            qmctx->ia_sample[j] = t;
+        }
+    }
+    qmctx->i_frame_num = qmctx->i_sample_num;
+    return 0;
+}
+
+void free_sample_table(QMContext* qmctx)
+{
+    free(qmctx->ia_sample);
+    qmctx->ia_sample    = NULL;
+    qmctx->i_sample_num = 0;
+}
+
+void init_sample_stats(SampleStats* ss, QMContext* qmctx)
+{
+    memset(ss, 0, sizeof(SampleStats));
+    pthread_mutex_init(&ss->mtx, NULL);
+    ss->i_pairs   = qmctx->i_sample_pairs;
+    ss->i_total   = qmctx->i_sample_num;
+    ss->i_enabled = 1;
+}
+
+/* the metric the interval is on: psnr, or ssim if psnr is not computed */
+static double frame_value(QMContext* qmctx, int cidx, int64_t ssd[], double ssim[])
+{
+    int    pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+    double pixel_max_ssd   = (double)pixel_max_value * pixel_max_value;
+
+    if (qmctx->i_metric_method & M_PSNR)
+        return ssd_to_psnr(pixel_max_ssd * qmctx->ia_win[cidx][2] * qmctx->ia_win[cidx][3], ssd[cidx]);
+    return ssim[cidx];
+}
+
+/* half width of the 95% interval of the mean of plane cidx over all pairs of the run, the frames counted
+ * are a sample of them: the finite population correction is 0 only once every pair is counted */
+static double half_width(SampleStats* ss, int cidx)
+{
+    double var, fpc = 1.0;
+
+    if (ss->i_frames < 2)
+        return HUGE_VAL;
+    var = ss->m2[cidx] / (ss->i_frames - 1);
+    if (ss->i_pairs > 1)
+        fpc = sqrt((double)(ss->i_pairs - ss->i_frames) / (ss->i_pairs - 1));
+    return SAMPLE_Z * sqrt(var / ss->i_frames) * fpc;
+}
+
+/* count a printed frame into the running means. SAMPLE_STOP: the --ci-stop tolerance is met */
+int sample_frame(SampleStats* ss, QMContext* qmctx, int64_t ssd[], double ssim[])
+{
+    int stop;
+
+    if (!ss->i_enabled)
+        return SAMPLE_GO;
+    pthread_mutex_lock(&ss->mtx);
+    ss->i_frames++;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        double v     = frame_value(qmctx, cidx, ssd, ssim);
+        double delta = v - ss->mean[cidx];
+        ss->mean[cidx] += delta / ss->i_frames;
+        ss->m2[cidx]   += delta * (v - ss->mean[cidx]);
+    }
+    stop = qmctx->f_ci_stop > 0 && ss->i_frames >= SAMPLE_MIN_FRAMES && ss->i_frames < ss->i_total;  // not on the last sampled frame
+    for (int cidx = CIDX_Y; cidx <= CIDX_V && stop; cidx++)
+        if (qmctx->i_planes & (1 << cidx))
+            stop = half_width(ss, cidx) <= qmctx->f_ci_stop;
+    ss->i_stopped |= stop;
+    pthread_mutex_unlock(&ss->mtx);
+    return stop ? SAMPLE_STOP : SAMPLE_GO;
+}
+
+void show_sample_stats(FILE* out, SampleStats* ss, QMContext* qmctx)
+{
+    const char* metric = qmctx->i_metric_method & M_PSNR ? "psnr" : "ssim";
+
+    if (!ss->i_enabled)
+        return;
+    fprintf(out, "sample: %d of %d frames%s\n", ss->i_frames, ss->i_pairs, ss->i_stopped ? ", stopped at --ci-stop" : "");
+    for (int cidx = CIDX_Y; cidx <= CIDX_V && ss->i_frames >= 2; cidx++)
+        if (qmctx->i_planes & (1 << cidx))
+            fprintf(out, "sample: %s %s mean %.4f +- %.4f (95%%)\n", plane_name[cidx], metric, ss->mean[cidx], half_width(ss, cidx));
+}
@@ -0,0 +1,207 @@
+/**
+ * ===========================================================================
+ * scaler.c
+ * - separable fixed-point resampler. Coefficients are computed once per
+ *   geometry; the per-frame passes are plain multiply-add loops over
+ *   contiguous rows that the compiler vectorizes (the vertical pass runs
+ *   along x, so every tap is one aligned row vector)
+ * ===========================================================================
+ */
+#include "scaler.h"
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+Scaler g_scaler;
+
+int parse_scale_method(const char* str)
+{
+    if (!strcmp(str, "bilinear"))
+        return SCALE_BILINEAR;
+    if (!strcmp(str, "bicubic"))
+        return SCALE_BICUBIC;
+    if (!strcmp(str, "lanczos"))
+        return SCALE_LANCZOS;
+    return -1;
+}
+
+static double filter_support(int method)
+{
+    return method == SCALE_BILINEAR ? 1.0 : (method == SCALE_BICUBIC ? 2.0 : 3.0);
+}
+
+static double filter_weight(int method, double x)
+{
+    x = fabs(x);
+    switch (method)
+    {
+    case SCALE_BILINEAR:
+        return x < 1.0 ? 1.0 - x : 0.0;
+    case SCALE_BICUBIC:  // Keys, a = -0.5
+        if (x < 1.0)
+            return (1.5 * x - 2.5) * x * x + 1.0;
+        if (x < 2.0)
+            return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+        return 0.0;
+    default:             // lanczos3
+        if (x < 1e-8)
+            return 1.0;
+        if (x >= 3.0)
+            return 0.0;
+        return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+    }
+}
+
+/* taps and positions mapping src_len pixels to dst_len, pixel centers aligned;
+ * downscaling widens the kernel by the ratio so it also low-passes */
+static int init_filter(ScaleFilter* flt, int method, int src_len, int dst_len)
+{
+    double ratio   = (double)src_len / dst_len;
+    double stretch = ratio > 1.0 ? ratio : 1.0;
+    double support = filter_support(method) * stretch;
+    int    taps    = 2 * (int)ceil(support);
+    double weight[64];
+
+    taps = taps > src_len ? src_len : taps;
+    taps = taps > 64 ? 64 : taps;
+    flt->i_taps = taps;
+    flt->pos  = (int *)malloc(dst_len * sizeof(int));
+    flt->coef = (int32_t *)malloc((size_t)dst_len * taps * sizeof(int32_t));
+    if (!flt->pos || !flt->coef)
+        return -1;
+
+    for (int x = 0; x < dst_len; x++)
+    {
+        double   center = (x + 0.5) * ratio - 0.5;
+        int      first  = (int)floor(center) - taps / 2 + 1;
+        int      start  = first < 0 ? 0 : (first + taps > src_len ? src_len - taps : first);
+        int32_t* coef   = flt->coef + (int64_t)x * taps;
+        double   sum    = 0.0;
+        int      isum   = 0;
+
+        memset(weight, 0, sizeof(weight));
+        for (int t = 0; t < taps; t++)
+        {
+            int    s = first + t;
+            double w = filter_weight(method, (s - center) / stretch);
+            s = s < 0 ? 0 : (s >= src_len ? src_len - 1 : s);  // replicate the edge pixel
+            weight[s - start] += w;
+            sum += w;
+        }
+        for (int t = 0; t < taps; t++)
+        {
+            coef[t] = (int32_t)floor(weight[t] / sum * (1 << SCALE_COEF_BITS) + 0.5);
+            isum   += coef[t];
+        }
+        coef[(int)(center - start + 0.5) < taps ? (int)(center - start + 0.5) : taps - 1] += (1 << SCALE_COEF_BITS) - isum;
+        flt->pos[x] = start;
+    }
+    return 0;
+}
+
+int init_scaler(Scaler* sc, int method, Frame* src_geom, Frame* dst_geom)
+{
+    memset(sc, 0, sizeof(Scaler));
+    sc->i_method = method;
+    sc->src_geom = *src_geom;
+    sc->dst_geom = *dst_geom;
+    for (int c = 0; c < 2; c++)
+    {
+        int cidx = c ? CIDX_U : CIDX_Y;
+        if (init_filter(&sc->hor[c], method, src_geom->width[cidx], dst_geom->width[cidx]) < 0
+            || init_filter(&sc->ver[c], method, src_geom->height[cidx], dst_geom->height[cidx]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void free_scaler(Scaler* sc)
+{
+    for (int c = 0; c < 2; c++)
+    {
+        free(sc->hor[c].pos);
+        free(sc->hor[c].coef);
+        free(sc->ver[c].pos);
+        free(sc->ver[c].coef);
+    }
+}
+
+/* horizontal pass output: every source row at the destination width */
+int get_scaler_temp_size(Scaler* sc)
+{
+    return sc->src_geom.height[CIDX_Y] * sc->dst_geom.width[CIDX_Y] * sizeof(int32_t);
+}
+
+static void scale_plane(ScaleFilter* hor, ScaleFilter* ver, uint8_t* src, int src_stride, int src_h,
+                        uint8_t* dst, int dst_stride, int dst_w, int dst_h, int pixel_size, int max, int32_t* mid)
+{
+    int32_t acc[4096];  // one output row, split in pieces for wider frames
+
+    // horizontal: src_h rows -> dst_w, SCALE_MID_BITS of fraction kept
+    for (int y = 0; y < src_h; y++)
+    {
+        int32_t* out = mid + (int64_t)y * dst_w;
+        for (int x = 0; x < dst_w; x++)
+        {
+            const int32_t* coef = hor->coef + (int64_t)x * hor->i_taps;
+            int32_t sum = 0;
+            if (pixel_size == 1)
+            {
+                const uint8_t* p = src + (int64_t)y * src_stride + hor->pos[x];
+                for (int t = 0; t < hor->i_taps; t++)
+                    sum += coef[t] * p[t];
+            }
+            else
+            {
+                const uint16_t* p = (const uint16_t *)(src + (int64_t)y * src_stride) + hor->pos[x];
+                for (int t = 0; t < hor->i_taps; t++)
+                    sum += coef[t] * p[t];
+            }
+            out[x] = (sum + (1 << (SCALE_COEF_BITS - SCALE_MID_BITS - 1))) >> (SCALE_COEF_BITS - SCALE_MID_BITS);
+        }
+    }
+
+    // vertical: tap by tap over whole rows
+    for (int y = 0; y < dst_h; y++)
+    {
+        const int32_t* coef = ver->coef + (int64_t)y * ver->i_taps;
+        for (int x0 = 0; x0 < dst_w; x0 += 4096)
+        {
+            int n = dst_w - x0 < 4096 ? dst_w - x0 : 4096;
+            for (int x = 0; x < n; x++)
+                acc[x] = 1 << (SCALE_COEF_BITS + SCALE_MID_BITS - 1);
+            for (int t = 0; t < ver->i_taps; t++)
+            {
+                const int32_t* row = mid + (int64_t)(ver->pos[y] + t) * dst_w + x0;
+                int32_t c = coef[t];
+                for (int x = 0; x < n; x++)
+                    acc[x] += c * row[x];
+            }
+            for (int x = 0; x < n; x++)
+            {
+                int v = acc[x] >> (SCALE_COEF_BITS + SCALE_MID_BITS);
+                v = v < 0 ? 0 : (v > max ? max : v);
+                if (pixel_size == 1)
+                    dst[(int64_t)y * dst_stride + x0 + x] = (uint8_t)v;
+                else
+                    ((uint16_t *)(dst + (int64_t)y * dst_stride))[x0 + x] = (uint16_t)v;
+            }
+        }
+    }
+}
+
+/* resample the selected planes of src (sc->src_geom) into dst (sc->dst_geom); temp: get_scaler_temp_size bytes */
+void scale_frame(Scaler* sc, Frame* src, Frame* dst, int planes, void* temp)
+{
+    int max = (1 << src->bit_depth) - 1;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int c = cidx == CIDX_Y ? 0 : 1;
+        if (planes & (1 << cidx))
+            scale_plane(&sc->hor[c], &sc->ver[c], src->yuv[cidx], src->stride[cidx], src->height[cidx],
+                        dst->yuv[cidx], dst->stride[cidx], dst->width[cidx], dst->height[cidx], src->pixel_size, max, (int32_t *)temp);
+    }
+}
@@ -0,0 +1,248 @@
+/**
+ * ===========================================================================
+ * ssimref.c
+ * - ref ssim sidecar: header, one fixed-size record per ref frame, then one
+ *   valid byte per ref frame. a record holds, for each selected plane, the
+ *   uint32_t sum of squares and uint16_t sum of every 4x4 block of the
+ *   ia_ref_win window, block row after block row
+ * - records are indexed by absolute ref frame, so --ref-skip, --dst-skip and
+ *   --*-fps runs share one sidecar; the key covers the ref fingerprint and
+ *   the window geometry, a mismatching sidecar is an error, not rebuilt
+ * - the cross term needs the ref pixels, ref is still read; the sidecar
+ *   saves the ref half of the block arithmetic, not the ref i/o
+ * ===========================================================================
+ */
+#include "ssimref.h"
+#include "cache.h"
+#include <string.h>
+
+SsimRef g_ssim_ref;
+
+typedef struct _ssim_ref_header
+{
+    int      i_magic;
+    int      i_frame_bytes;
+    int64_t  i64_frames;   // records that follow, then as many valid bytes
+    uint64_t i64_key;
+}SsimRefHeader;
+
+static int seek_file(FILE* f, int64_t pos)
+{
+#ifdef linux
+    return fseeko(f, pos, SEEK_SET);
+#else
+    return _fseeki64(f, pos, SEEK_SET);
+#endif
+}
+
+/* key: ref fingerprint + everything that decides which ref pixels a block covers */
+static int ssim_ref_key(QMContext* qmctx, uint64_t* key)
+{
+    char     params[256];
+    uint64_t ref_fp;
+    int      n;
+
+    if (input_fingerprint(qmctx->s_ref_fname, &ref_fp) < 0)
+        return -1;
+    n = snprintf(params, sizeof(params), "%dx%d bd%d cf%d p%d s%d/%d %dx%d", qmctx->i_ref_width, qmctx->i_ref_height,
+                 qmctx->i_bit_depth, qmctx->i_chroma_format, qmctx->i_planes, qmctx->i_scale, qmctx->i_scale_target,
+                 qmctx->i_scale ? qmctx->ia_width[CIDX_Y] : 0, qmctx->i_scale ? qmctx->ia_height[CIDX_Y] : 0);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V && n < (int)sizeof(params); cidx++)
+        n += snprintf(params + n, sizeof(params) - n, " %d,%d,%d,%d", qmctx->ia_ref_win[cidx][0], qmctx->ia_ref_win[cidx][1],
+                      qmctx->ia_win[cidx][2], qmctx->ia_win[cidx][3]);
+    *key = xxh64(params, strlen(params), ref_fp);
+    return 0;
+}
+
+static int open_for_build(SsimRef* sr, QMContext* qmctx)
+{
+    char        tmp[FILE_NAME_LENGTH + 8];
+    FrameSource ref_src;
+    Frame       g;
+
+    init_frame_geometry(&g, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    if (open_frame_source(&ref_src, qmctx->s_ref_fname, 0) < 0)
+        return -1;
+    sr->i64_frames = ref_src.i64_file_size / g.frame_size;
+    close_frame_source(&ref_src);
+    sr->valid = (char *)calloc(sr->i64_frames + 1, 1);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", sr->s_fname);
+    sr->file = fopen(tmp, "wb");
+    if (sr->valid == NULL || sr->file == NULL)
+        return -1;
+    sr->i_build = 1;
+    return 0;
+}
+
+static int open_for_read(SsimRef* sr)
+{
+    SsimRefHeader hdr;
+
+    if (source_read(&sr->src, 0, &hdr, sizeof(hdr)) < 0 || hdr.i_magic != SSIMREF_MAGIC)
+    {
+        fprintf(stderr, "%s is not an ssim ref sidecar!\n", sr->s_fname);
+        return -1;
+    }
+    if (hdr.i64_key != sr->i64_key || hdr.i_frame_bytes != sr->i_frame_bytes)
+    {
+        fprintf(stderr, "Sidecar %s was built for another ref or window, remove it to rebuild!\n", sr->s_fname);
+        return -1;
+    }
+    sr->i64_frames = hdr.i64_frames;
+    sr->valid      = (char *)malloc(sr->i64_frames + 1);
+    if (sr->valid == NULL
+        || source_read(&sr->src, sizeof(hdr) + sr->i64_frames * sr->i_frame_bytes, sr->valid, (int)sr->i64_frames) < 0)
+    {
+        fprintf(stderr, "Read sidecar %s error!\n", sr->s_fname);
+        return -1;
+    }
+    return 0;
+}
+
+/* load the sidecar if it exists, else prepare building it. -1 if it cannot be used */
+int open_ssim_ref(SsimRef* sr, QMContext* qmctx)
+{
+    FILE* f;
+    int   pos = 0;
+
+    memset(sr, 0, sizeof(SsimRef));
+    snprintf(sr->s_fname, sizeof(sr->s_fname), "%s", qmctx->s_ssim_ref_fname);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        if (qmctx->i_planes & (1 << cidx))
+            sr->ia_blocks[cidx] = (qmctx->ia_win[cidx][2] >> 2) * (qmctx->ia_win[cidx][3] >> 2);
+        sr->ia_plane_pos[cidx] = pos;
+        pos += sr->ia_blocks[cidx] * (int)sizeof(uint32_t) + ((sr->ia_blocks[cidx] * (int)sizeof(uint16_t) + 3) & ~3);
+    }
+    sr->i_frame_bytes = pos;
+    if (ssim_ref_key(qmctx, &sr->i64_key) < 0)
+    {
+        fprintf(stderr, "Fingerprinting ref %s failed!\n", qmctx->s_ref_fname);
+        return -1;
+    }
+    pthread_mutex_init(&sr->mtx, NULL);
+    sr->i_enabled = 1;
+
+    f = fopen(sr->s_fname, "rb");
+    if (f == NULL)
+        return open_for_build(sr, qmctx);
+    fclose(f);
+    if (open_frame_source(&sr->src, sr->s_fname, 0) < 0)
+        return -1;
+    return open_for_read(sr);
+}
+
+/* a built sidecar gets its header and valid bytes and replaces s_fname; only if this run computed any frame */
+void close_ssim_ref(SsimRef* sr)
+{
+    char          tmp[FILE_NAME_LENGTH + 8];
+    SsimRefHeader hdr;
+    int           ok;
+
+    if (!sr->i_enabled)
+        return;
+    if (sr->i_build && sr->file)
+    {
+        snprintf(tmp, sizeof(tmp), "%s.tmp", sr->s_fname);
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.i_magic       = SSIMREF_MAGIC;
+        hdr.i_frame_bytes = sr->i_frame_bytes;
+        hdr.i64_frames    = sr->i64_frames;
+        hdr.i64_key       = sr->i64_key;
+        ok = sr->i64_built > 0
+             && seek_file(sr->file, 0) == 0 && fwrite(&hdr, sizeof(hdr), 1, sr->file) == 1
+             && seek_file(sr->file, sizeof(hdr) + sr->i64_frames * sr->i_frame_bytes) == 0
+             && fwrite(sr->valid, 1, sr->i64_frames, sr->file) == (size_t)sr->i64_frames;
+        if (fclose(sr->file) == 0 && ok)
+        {
+            remove(sr->s_fname);  // rename does not replace on windows
+            rename(tmp, sr->s_fname);
+        }
+        else
+            remove(tmp);
+    }
+    else if (!sr->i_build)
+        close_frame_source(&sr->src);
+    free(sr->valid);
+    pthread_mutex_destroy(&sr->mtx);
+    sr->i_enabled = 0;
+}
+
+/* one frame record after get_metric_temp_size bytes of the metric temp buffer */
+int get_ssim_ref_temp_size(SsimRef* sr)
+{
+    return sr->i_enabled ? sr->i_frame_bytes : 0;
+}
+
+static void record_to_stats(SsimRef* sr, uint8_t* rec, SsimRefStats* stats)
+{
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        stats->sq[cidx]  = NULL;
+        stats->sum[cidx] = NULL;
+        if (sr->ia_blocks[cidx] == 0)
+            continue;
+        stats->sq[cidx]  = (uint32_t *)(rec + sr->ia_plane_pos[cidx]);
+        stats->sum[cidx] = (uint16_t *)(rec + sr->ia_plane_pos[cidx] + sr->ia_blocks[cidx] * sizeof(uint32_t));
+    }
+}
+
+/* get_frame_metric of the pair whose ref is ref_frm, with the ref block sums of the sidecar where it has them.
+ * while building, the sums are computed from ref, used for this frame and stored */
+void ssim_ref_frame_metric(SsimRef* sr, QMContext* qmctx, int64_t ref_frm, Frame* ref, Frame* dst, void* temp,
+                           int64_t ssd[], double ssim[])
+{
+    uint8_t*     rec = (uint8_t *)temp + get_metric_temp_size(qmctx);
+    SsimRefStats stats;
+    int          have;
+
+    if (!sr->i_enabled || ref_frm < 0 || ref_frm >= sr->i64_frames)
+    {
+        get_frame_metric(qmctx, ref, dst, temp, ssd, ssim);
+        return;
+    }
+    record_to_stats(sr, rec, &stats);
+    if (sr->i_build)
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        {
+            int* ref_win = qmctx->ia_ref_win[cidx];
+            int  stride  = ref->stride[cidx];
+            if (stats.sq[cidx])
+                ssim_ref_block_stats(ref->yuv[cidx] + (int64_t)ref_win[1] * stride + ref_win[0] * ref->pixel_size, stride,
+                                     qmctx->ia_win[cidx][2], qmctx->ia_win[cidx][3], ref->pixel_size,
+                                     stats.sq[cidx], stats.sum[cidx]);
+        }
+        get_frame_metric_refstats(qmctx, ref, dst, temp, &stats, ssd, ssim);
+        pthread_mutex_lock(&sr->mtx);
+        if (!sr->valid[ref_frm]  // --fps-map repeat: a ref frame can come twice
+            && seek_file(sr->file, sizeof(SsimRefHeader) + ref_frm * sr->i_frame_bytes) == 0
+            && fwrite(rec, sr->i_frame_bytes, 1, sr->file) == 1)
+        {
+            sr->valid[ref_frm] = 1;
+            sr->i64_built++;
+        }
+        pthread_mutex_unlock(&sr->mtx);
+        return;
+    }
+
+    have = sr->valid[ref_frm]
+           && source_read(&sr->src, sizeof(SsimRefHeader) + ref_frm * sr->i_frame_bytes, rec, sr->i_frame_bytes) >= 0;
+    get_frame_metric_refstats(qmctx, ref, dst, temp, have ? &stats : NULL, ssd, ssim);
+    if (have)
+    {
+        pthread_mutex_lock(&sr->mtx);
+        sr->i64_loaded++;
+        pthread_mutex_unlock(&sr->mtx);
+    }
+}
+
+void show_ssim_ref_stats(FILE* out, SsimRef* sr)
+{
+    if (!sr->i_enabled)
+        return;
+    if (sr->i_build)
+        fprintf(out, "ssim-ref: built %s, %lld ref frames\n", sr->s_fname, (long long)sr->i64_built);
+    else
+        fprintf(out, "ssim-ref: %lld frames with ref sums from %s\n", (long long)sr->i64_loaded, sr->s_fname);
+}
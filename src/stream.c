@@ -0,0 +1,93 @@
+/**
+ * ===========================================================================
+ * stream.c
+ * - stripe streaming metric of one frame pair
+ * ===========================================================================
+ */
+#include "stream.h"
+#include "framepool.h"
+#include <string.h>
+
+int init_stream_context(StreamCtx* stctx, QMContext* qmctx, int rows)
+{
+    Frame* g = &stctx->geom;
+    int size_temp;
+
+    init_frame_geometry(g, qmctx->ia_width[CIDX_Y], qmctx->ia_height[CIDX_Y], qmctx->i_dst_bit_depth, qmctx->i_dst_chroma_format);
+    init_frame_geometry(&stctx->ref_geom, qmctx->i_ref_width, qmctx->i_ref_height, qmctx->i_ref_bit_depth, qmctx->i_ref_chroma_format);
+    rows = (rows + 3) & ~3;
+    if (rows < 4)
+        rows = 4;
+    if (rows > g->height[CIDX_Y])
+        rows = g->height[CIDX_Y];
+    stctx->i_rows   = rows;
+    stctx->ref_rows = (uint8_t *)frame_pool_alloc(&g_frame_pool, (size_t)rows * stctx->ref_geom.width[CIDX_Y] * g->pixel_size);
+    stctx->dst_rows = (uint8_t *)frame_pool_alloc(&g_frame_pool, (size_t)rows * g->width[CIDX_Y] * g->pixel_size);
+
+    size_temp = get_ssim_temp_size(g->width[CIDX_Y], g->bit_depth);
+    stctx->temp = malloc(size_temp);
+    memset(stctx->temp, 0, size_temp);
+    if (!stctx->ref_rows || !stctx->dst_rows || !stctx->temp)
+        return -1;
+    return 0;
+}
+
+void free_stream_context(StreamCtx* stctx)
+{
+    frame_pool_release(&g_frame_pool, stctx->ref_rows);
+    frame_pool_release(&g_frame_pool, stctx->dst_rows);
+    free(stctx->temp);
+}
+
+int stream_frame_metric(StreamCtx* stctx, QMContext* qmctx, FrameSource* ref_src, int ref_frm, FrameSource* dst_src, int dst_frm,
+                        int64_t ssd[], double ssim[])
+{
+    Frame*  g  = &stctx->geom;
+    Frame*  rg = &stctx->ref_geom;
+    int64_t ref_pos = (int64_t)ref_frm * rg->frame_size;
+    int64_t dst_pos = (int64_t)dst_frm * g->frame_size;
+    int     pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+    SsimStream ss;
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        int* win        = qmctx->ia_win[cidx];  // only the rows of the window are read
+        int* ref_win    = qmctx->ia_ref_win[cidx];
+        int  width      = win[2];
+        int  ref_stride = rg->width[cidx] * rg->pixel_size;
+        int  dst_stride = g->width[cidx] * g->pixel_size;
+        uint8_t* p_ref  = stctx->ref_rows + ref_win[0] * rg->pixel_size;
+        uint8_t* p_dst  = stctx->dst_rows + win[0] * g->pixel_size;
+
+        ssd[cidx]  = 0;
+        ssim[cidx] = 0;
+        if (qmctx->i_planes & (1 << cidx))
+        {
+            ssim_stream_init(&ss, stctx->temp, width, g->pixel_size, pixel_max_value);
+            for (int y = 0; y < win[3]; y += stctx->i_rows)
+            {
+                int rows = win[3] - y < stctx->i_rows ? win[3] - y : stctx->i_rows;
+                if (source_read(ref_src, ref_pos + (int64_t)(ref_win[1] + y) * ref_stride, stctx->ref_rows, rows * ref_stride) < 0)
+                    return -1;
+                if (source_read(dst_src, dst_pos + (int64_t)(win[1] + y) * dst_stride, stctx->dst_rows, rows * dst_stride) < 0)
+                    return -1;
+
+                if (qmctx->i_metric_method & M_PSNR)
+                {
+                    if (g->pixel_size == 1)
+                        ssd[cidx] += get_block_ssd_8bit_stride(p_ref, rg->width[cidx], p_dst, g->width[cidx], width, rows);
+                    else
+                        ssd[cidx] += get_block_ssd_10bit_stride((uint16_t*)p_ref, rg->width[cidx], (uint16_t*)p_dst, g->width[cidx], width, rows);
+                }
+                if (qmctx->i_metric_method & M_SSIM)
+                    ssim_stream_push(&ss, p_ref, ref_stride, p_dst, dst_stride, rows >> 2);
+            }
+            if (qmctx->i_metric_method & M_SSIM)
+                ssim[cidx] = ssim_stream_end(&ss);
+        }
+
+        ref_pos += (int64_t)rg->height[cidx] * ref_stride;
+        dst_pos += (int64_t)g->height[cidx] * dst_stride;
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * ===========================================================================
+ * stripe.c
+ * - intra-frame parallelism for ssd and ssim
+ * ===========================================================================
+ */
+#include "stripe.h"
+#include <string.h>
+
+int init_stripe_context(StripeCtx* sctx, QMContext* qmctx, threadpool_t* p_pool)
+{
+    int stripes = qmctx->i_stripes > MAX_STRIPES ? MAX_STRIPES : qmctx->i_stripes;
+    int size_temp = get_ssim_temp_size(qmctx->ia_width[CIDX_Y], qmctx->i_bit_depth);
+
+    memset(sctx, 0, sizeof(StripeCtx));
+    sctx->qmctx     = qmctx;
+    sctx->p_pool    = p_pool;
+    sctx->i_stripes = stripes;
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        if (!(qmctx->i_planes & (1 << cidx)))
+            continue;
+        int height   = qmctx->ia_win[cidx][3];  // bands of the --roi window, the whole plane without one
+        int blk_rows = height >> 2;
+        int bands    = stripes < blk_rows ? stripes : (blk_rows > 0 ? blk_rows : 1);
+
+        sctx->row_ssim[cidx] = (float *)malloc((blk_rows + 1) * sizeof(float));
+        for (int b = 0; b < bands; b++)
+        {
+            StripeJob* job = &sctx->jobs[sctx->i_job_num++];
+            job->sctx   = sctx;
+            job->i_cidx = cidx;
+            // bands are cut on 4-row boundaries; the last one takes the rows below the last full block row
+            job->i_row_begin = 4 * (blk_rows * b / bands);
+            job->i_row_end   = b == bands - 1 ? height : 4 * (blk_rows * (b + 1) / bands);
+            job->i_blk_begin = blk_rows * b / bands;
+            job->i_blk_end   = blk_rows * (b + 1) / bands;
+            if (job->i_blk_begin < 1)
+                job->i_blk_begin = 1;
+            job->temp = malloc(size_temp);
+            memset(job->temp, 0, size_temp);
+        }
+    }
+    return 0;
+}
+
+void free_stripe_context(StripeCtx* sctx)
+{
+    for (int i = 0; i < sctx->i_job_num; i++)
+        free(sctx->jobs[i].temp);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        free(sctx->row_ssim[cidx]);
+}
+
+static void* process_one_stripe(void* arg)
+{
+    StripeJob*   job = (StripeJob *)arg;
+    StripeCtx*  sctx = job->sctx;
+    QMContext* qmctx = sctx->qmctx;
+    Frame*       ref = sctx->ref_frame;
+    Frame*       dst = sctx->dst_frame;
+    int         cidx = job->i_cidx;
+    int*         win = qmctx->ia_win[cidx];
+    int*     ref_win = qmctx->ia_ref_win[cidx];
+    int        width = win[2];
+    int   ref_stride = ref->stride[cidx];
+    int   dst_stride = dst->stride[cidx];
+    uint8_t*  p_ref0 = ref->yuv[cidx] + (int64_t)ref_win[1] * ref_stride + ref_win[0] * ref->pixel_size;
+    uint8_t*  p_dst0 = dst->yuv[cidx] + (int64_t)win[1] * dst_stride + win[0] * dst->pixel_size;
+    int pixel_max_value = (1 << qmctx->i_bit_depth) - 1;
+    int  row_first = job->i_blk_begin > 0 && 4 * (job->i_blk_begin - 1) < job->i_row_begin ? 4 * (job->i_blk_begin - 1) : job->i_row_begin;
+    int  row_last  = 4 * job->i_blk_end > job->i_row_end ? 4 * job->i_blk_end : job->i_row_end;
+
+    // identical rows under both the ssd band and the ssim rows: ssd 0, every ssim row the sum of width / 4 - 1 exact ones
+    if (plane_identical(p_ref0 + (int64_t)row_first * ref_stride, ref_stride, p_dst0 + (int64_t)row_first * dst_stride, dst_stride,
+                        width * ref->pixel_size, row_last - row_first))
+    {
+        for (int y = job->i_blk_begin; y < job->i_blk_end; y++)
+            sctx->row_ssim[cidx][y] = (float)((width >> 2) - 1);
+        return NULL;
+    }
+
+    if (qmctx->i_metric_method & M_PSNR)
+    {
+        int rows = job->i_row_end - job->i_row_begin;
+        uint8_t* p_ref = p_ref0 + (int64_t)job->i_row_begin * ref_stride;
+        uint8_t* p_dst = p_dst0 + (int64_t)job->i_row_begin * dst_stride;
+        if (ref->pixel_size == 1)
+            job->ssd = get_block_ssd_8bit_stride(p_ref, ref_stride / ref->pixel_size, p_dst, dst_stride / dst->pixel_size, width, rows);
+        else
+            job->ssd = get_block_ssd_10bit_stride((uint16_t*)p_ref, ref_stride / ref->pixel_size, (uint16_t*)p_dst, dst_stride / dst->pixel_size, width, rows);
+    }
+    if ((qmctx->i_metric_method & M_SSIM) && job->i_blk_begin < job->i_blk_end)
+    {
+        if (ref->pixel_size == 1)
+            ssim_plane_band(p_ref0, ref_stride, p_dst0, dst_stride,
+                            width, job->i_blk_begin, job->i_blk_end, job->temp, sctx->row_ssim[cidx]);
+        else
+            ssim_plane_band_16bit(p_ref0, ref_stride, p_dst0, dst_stride,
+                                  width, job->i_blk_begin, job->i_blk_end, job->temp, sctx->row_ssim[cidx], pixel_max_value);
+    }
+    return NULL;
+}
+
+void stripe_frame_metric(StripeCtx* sctx, Frame* ref, Frame* dst, int64_t ssd[], double ssim[])
+{
+    sctx->ref_frame = ref;
+    sctx->dst_frame = dst;
+    for (int i = 0; i < sctx->i_job_num; i++)
+    {
+        sctx->jobs[i].ssd = 0;
+        threadpool_run(sctx->p_pool, process_one_stripe, &sctx->jobs[i], 0);
+    }
+    threadpool_sync(sctx->p_pool);
+
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+    {
+        ssd[cidx]  = 0;
+        ssim[cidx] = 0;
+    }
+    for (int i = 0; i < sctx->i_job_num; i++)
+        ssd[sctx->jobs[i].i_cidx] += sctx->jobs[i].ssd;
+    if (sctx->qmctx->i_metric_method & M_SSIM)
+    {
+        for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+            if (sctx->row_ssim[cidx])
+                ssim[cidx] = ssim_rows_to_plane(sctx->row_ssim[cidx], sctx->qmctx->ia_win[cidx][2], sctx->qmctx->ia_win[cidx][3]);
+    }
+}
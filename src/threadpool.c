@@ -115,16 +115,38 @@ void* thread_run(void *arg)
     JobList*   todojobLst = &pool->todo_job_list;
     JobList* unusedjobLst = &pool->unused_job_list;
     Job*        newJob;
+
+    if (pool->p_cpus)
+    {
+        pthread_mutex_lock(&pool->tp_mutex);
+        int id = pool->i_started++;
+        pthread_mutex_unlock(&pool->tp_mutex);
+        pin_current_thread(pool->p_cpus, pool->i_pin_core ? id : -1);
+    }
+
     while (pool->i_exit == 0)
     {
         newJob = remove_job_from_list(todojobLst);
+        if (newJob == NULL)  // todo list closed by threadpool_delete
+            break;
         newJob->func(newJob->arg);
         push_job_into_list(unusedjobLst, newJob);
+
+        pthread_mutex_lock(&pool->tp_mutex);
+        pool->i_pending--;
+        pthread_cond_broadcast(&pool->tp_cond);
+        pthread_mutex_unlock(&pool->tp_mutex);
     }
     return NULL;
 }
 
 int threadpool_init(threadpool_t **p_pool, int threads)
+{
+    return threadpool_init_affinity(p_pool, threads, NULL, 0);
+}
+
+/* cpus must stay valid until threadpool_delete. -1 and *p_pool NULL if no worker could be started */
+int threadpool_init_affinity(threadpool_t **p_pool, int threads, const CpuSet* cpus, int pin_core)
 {
     int ret;
     *p_pool = (threadpool_t*)malloc(sizeof(threadpool_t));
@@ -137,17 +159,34 @@ int threadpool_init(threadpool_t **p_pool, int threads)
 
     myprintf("unused_job_list %p, jobnum %d; todo_job_list %p, jobnum %d\n", unused_job_lst, unused_job_lst->i_jobnum, todo_job_lst, todo_job_lst->i_jobnum);
 
+    pthread_mutex_init(&threadp->tp_mutex, NULL);
+    pthread_cond_init(&threadp->tp_cond, NULL);
+
     // start threads
     threadp->i_threads = threads;
+    threadp->i_pending = 0;
     threadp->i_exit = 0;
+    threadp->p_cpus = cpus;
+    threadp->i_pin_core = pin_core;
+    threadp->i_started  = 0;
     for (int i = 0; i < threads; i++)
     {
         ret = pthread_create(&threadp->p_thread_handles[i], NULL, thread_run, (void*)threadp);
-#ifndef linux
-        Sleep(100);
-#else
-        usleep(1000);
-#endif
+        if (ret != 0)
+        {
+            threadp->i_threads = i;  // keep the workers that did start
+            break;
+        }
+    }
+    if (threadp->i_threads == 0)  // jobs would wait forever
+    {
+        free_job_list(todo_job_lst);
+        free_job_list(unused_job_lst);
+        pthread_mutex_destroy(&threadp->tp_mutex);
+        pthread_cond_destroy(&threadp->tp_cond);
+        free(threadp);
+        *p_pool = NULL;
+        return -1;
     }
 
     return 1;
@@ -160,10 +199,22 @@ void threadpool_run(threadpool_t *pool, void *(*func)(void *), void *arg, int wa
     {
         newJob->func = func;
         newJob->arg  = arg;
+        pthread_mutex_lock(&pool->tp_mutex);
+        pool->i_pending++;
+        pthread_mutex_unlock(&pool->tp_mutex);
         push_job_into_list(&pool->todo_job_list, newJob);
     }
 }
 
+// block until every job handed to threadpool_run has finished
+void threadpool_sync(threadpool_t *pool)
+{
+    pthread_mutex_lock(&pool->tp_mutex);
+    while (pool->i_pending > 0)
+        pthread_cond_wait(&pool->tp_cond, &pool->tp_mutex);
+    pthread_mutex_unlock(&pool->tp_mutex);
+}
+
 void *threadpool_wait(threadpool_t *pool, void *arg)
 {
     for(int i = 0; i < pool->i_threads; i++)
@@ -175,8 +226,10 @@ void  threadpool_delete(threadpool_t *pool)
 {
     JobList* unused_job_lst = &(pool->unused_job_list);
     JobList*   todo_job_lst = &(pool->todo_job_list);
+    threadpool_sync(pool);
     pool->i_exit = 1;
+    free_job_list(todo_job_lst);  // wakes idle workers blocked on the empty todo list
     threadpool_wait(pool, NULL);
     free_job_list(unused_job_lst);
-    free_job_list(todo_job_lst);
+    free(pool);
 }
\ No newline at end of file
@@ -1,10 +1,11 @@
 #include "yuvframe.h"
 #include "defines.h"
+#include "framepool.h"
 #include <stdint.h>
+#include <string.h>
 
-int alloc_frame(Frame* f, int width, int height, int bit_depth, int chroma_format)
+void init_frame_geometry(Frame* f, int width, int height, int bit_depth, int chroma_format)
 {
-    unsigned char* yuv_buf = NULL;
     f->width[CIDX_Y] = width;
     f->height[CIDX_Y] = height;
     f->chroma_format = chroma_format;
@@ -28,26 +29,61 @@ int alloc_frame(Frame* f, int width, int height, int bit_depth, int chroma_forma
     f->y_size = f->width[CIDX_Y] * f->height[CIDX_Y] * f->pixel_size;
     f->uv_size = f->width[CIDX_CHROMA] * f->height[CIDX_CHROMA] * f->pixel_size;
     f->frame_size = f->y_size + 2 * f->uv_size;
-    yuv_buf = (unsigned char *)malloc(f->frame_size);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        f->stride[cidx] = f->width[cidx] * f->pixel_size;
+    f->yuv[CIDX_Y] = f->yuv[CIDX_U] = f->yuv[CIDX_V] = NULL;
+}
+
+/* every plane and every row starts FRAME_ALIGN aligned, the rows are zero padded up to the next
+ * FRAME_ALIGN bytes: a kernel may run full vectors over the padding, it is the same in ref and dst */
+#define ALIGNED_ROW(size) (((size) + FRAME_ALIGN - 1) & ~(FRAME_ALIGN - 1))
+
+int alloc_frame(Frame* f, int width, int height, int bit_depth, int chroma_format)
+{
+    unsigned char* yuv_buf = NULL;
+    int y_span, uv_span;
+    init_frame_geometry(f, width, height, bit_depth, chroma_format);
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        f->stride[cidx] = ALIGNED_ROW(f->width[cidx] * f->pixel_size);
+    y_span  = f->stride[CIDX_Y] * f->height[CIDX_Y];
+    uv_span = f->stride[CIDX_CHROMA] * f->height[CIDX_CHROMA];
+    yuv_buf = (unsigned char *)frame_pool_alloc(&g_frame_pool, y_span + 2 * uv_span);
+    if (yuv_buf == NULL)
+        return -1;
     f->yuv[CIDX_Y] = yuv_buf;
-    f->yuv[CIDX_U] = yuv_buf + f->y_size;
-    f->yuv[CIDX_V] = yuv_buf + f->y_size + f->uv_size;
+    f->yuv[CIDX_U] = yuv_buf + y_span;
+    f->yuv[CIDX_V] = yuv_buf + y_span + uv_span;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)  // pooled blocks come back dirty, the padding must read as zero
+    {
+        int row_size = f->width[cidx] * f->pixel_size;
+        for (int y = 0; y < f->height[cidx] && f->stride[cidx] > row_size; y++)
+            memset(f->yuv[cidx] + (int64_t)y * f->stride[cidx] + row_size, 0, f->stride[cidx] - row_size);
+    }
     return 1;
 }
 
 void free_frame(Frame* f)
 {
-    free(f->yuv[CIDX_Y]);
+    frame_pool_release(&g_frame_pool, f->yuv[CIDX_Y]);
+}
+
+/* a plane is packed in the file, its rows go stride[cidx] bytes apart */
+static int read_plane(FILE* in_f, Frame* f, int cidx)
+{
+    size_t row_size = (size_t)f->width[cidx] * f->pixel_size;
+    if (f->stride[cidx] == (int)row_size)
+        return fread(f->yuv[cidx], 1, row_size * f->height[cidx], in_f) == row_size * f->height[cidx] ? 0 : -1;
+    for (int y = 0; y < f->height[cidx]; y++)
+        if (fread(f->yuv[cidx] + (int64_t)y * f->stride[cidx], 1, row_size, in_f) != row_size)
+            return -1;
+    return 0;
 }
 
 int read_frame(FILE* in_f, Frame* f)
 {
-    if (f->y_size != fread(f->yuv[CIDX_Y], 1, f->y_size, in_f))
-        return -1;
-    if (f->uv_size != fread(f->yuv[CIDX_U], 1, f->uv_size, in_f))
-        return -1;
-    if (f->uv_size != fread(f->yuv[CIDX_V], 1, f->uv_size, in_f))
-        return -1;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        if (read_plane(in_f, f, cidx) < 0)
+            return -1;
     return 0;
 }
 
@@ -69,12 +105,9 @@ int read_nframe(FILE* in_f, Frame* f, int frm_num)
     if (ret != 0)
         return -1;
 
-    if (f->y_size != fread(f->yuv[CIDX_Y], 1, f->y_size, in_f))
-        return -1;
-    if (f->uv_size != fread(f->yuv[CIDX_U], 1, f->uv_size, in_f))
-        return -1;
-    if (f->uv_size != fread(f->yuv[CIDX_V], 1, f->uv_size, in_f))
-        return -1;
+    for (int cidx = CIDX_Y; cidx <= CIDX_V; cidx++)
+        if (read_plane(in_f, f, cidx) < 0)
+            return -1;
     return 0;
 }
 